@@ -0,0 +1,184 @@
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "slice-mainloop.h"
+#include "slice-server.h"
+
+// a pipe filled slowly by another thread is queued with SliceSessionWriteFile, the loop must sleep while the pipe is empty
+#define TEST_PORT           5679
+#define TEST_CHUNK_SIZE     4096
+#define TEST_CHUNK_COUNT    64
+#define TEST_CHUNK_DELAY    20000       // usec between chunks
+#define TEST_TOTAL          (TEST_CHUNK_SIZE * TEST_CHUNK_COUNT)
+
+// a loop spinning on the socket makes millions of iterations, one sleeping on the pipe a few per chunk
+#define TEST_MAX_ITERATIONS (TEST_CHUNK_COUNT * 8 + 64)
+
+SliceMainloop *mainloop = NULL;
+
+static int test_port = TEST_PORT;
+static int pipe_fd[2] = { -1, -1 };
+static int started = 0;
+static int received = 0;
+static int corrupted = 0;
+
+static void *pipe_writer(void *arg)
+{
+    char chunk[TEST_CHUNK_SIZE];
+    int i, j, n, off;
+
+    for (i = 0; i < TEST_CHUNK_COUNT; i++) {
+        for (j = 0; j < TEST_CHUNK_SIZE; j++) chunk[j] = (char)(((i * TEST_CHUNK_SIZE) + j) % 251);
+
+        usleep(TEST_CHUNK_DELAY);
+
+        for (off = 0; off < TEST_CHUNK_SIZE; off += n) {
+            if ((n = write(pipe_fd[1], chunk + off, TEST_CHUNK_SIZE - off)) < 0) {
+                if (errno == EINTR) { n = 0; continue; }
+                printf("write pipe return error [%s]\n", strerror(errno));
+                close(pipe_fd[1]);
+                return NULL;
+            }
+        }
+    }
+
+    close(pipe_fd[1]);
+
+    return NULL;
+}
+
+static void quit_task(SliceMainloop *mainloop, void *arg)
+{
+    SliceMainloopQuit(mainloop);
+}
+
+static void *socket_reader(void *arg)
+{
+    struct sockaddr_in addr;
+    char buff[TEST_CHUNK_SIZE];
+    int fd, n, i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(test_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        printf("connect return error [%s]\n", strerror(errno));
+        SliceMainloopPost(mainloop, quit_task, NULL, NULL);
+        return NULL;
+    }
+
+    if (write(fd, "go", 2) != 2) printf("write socket return error [%s]\n", strerror(errno));
+
+    while (received < TEST_TOTAL && (n = read(fd, buff, sizeof(buff))) > 0) {
+        for (i = 0; i < n; i++) {
+            if (buff[i] != (char)((received + i) % 251)) corrupted++;
+        }
+
+        received += n;
+    }
+
+    close(fd);
+
+    SliceMainloopPost(mainloop, quit_task, NULL, NULL);
+
+    return NULL;
+}
+
+static SliceReturnType session_read_callback(SliceSession *session, int length, void *user_data, char *err)
+{
+    pthread_t writer;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    SliceSessionClearReadBuffer(session, NULL);
+
+    if (started) return SLICE_RETURN_NORMAL;
+
+    if (pipe(pipe_fd) != 0) {
+        if (err) sprintf(err, "pipe return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+    started = 1;
+
+    // the entry reads from its own dup of the read end, ours is closed right away
+    if (SliceSessionWriteFile(session, pipe_fd[0], 0, TEST_TOTAL, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceSessionWriteFile return error [%s]", err_buff);
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        return SLICE_RETURN_ERROR;
+    }
+
+    close(pipe_fd[0]);
+
+    if (pthread_create(&writer, NULL, pipe_writer, NULL) != 0) {
+        if (err) sprintf(err, "pthread_create return error");
+        return SLICE_RETURN_ERROR;
+    }
+
+    pthread_detach(writer);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+static void connection_close_callback(SliceConnection *connection, void *user_data, char *err)
+{
+    printf("Connection sock [%d] connection_close_callback [%s]\n", SliceIOGetFD(SliceConnectionGetMainloopEvent(connection)), err);
+}
+
+int main(int argc, char **argv)
+{
+    SliceServer *server;
+    SliceMainloopStats stats;
+    pthread_t reader;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (argc > 1) test_port = atoi(argv[1]);
+
+    if (!(mainloop = SliceMainloopCreate(128, 128, 1000, err_buff))) {
+        printf("SliceMainloopCreate return error [%s]\n", err_buff);
+        return -1;
+    }
+
+    if (!(server = SliceServerCreate(mainloop, SLICE_SERVER_MODE_IP4_TCP, "127.0.0.1", test_port, NULL, NULL, NULL, session_read_callback, connection_close_callback, err_buff))) {
+        printf("SliceServerCreate return error [%s]\n", err_buff);
+        SliceMainloopDestroy(mainloop, NULL);
+        return -1;
+    }
+
+    SliceMainloopSetStats(mainloop, 1, NULL);
+
+    if (pthread_create(&reader, NULL, socket_reader, NULL) != 0) {
+        printf("pthread_create return error\n");
+        SliceMainloopDestroy(mainloop, NULL);
+        return -1;
+    }
+
+    SliceMainloopRun(mainloop, NULL);
+
+    pthread_join(reader, NULL);
+
+    SliceMainloopGetStats(mainloop, &stats, NULL);
+
+    printf("received [%d/%d] corrupted [%d] iterations [%llu]\n", received, TEST_TOTAL, corrupted, stats.iterations);
+
+    SliceMainloopDestroy(mainloop, NULL);
+
+    if (received != TEST_TOTAL || corrupted || stats.iterations > TEST_MAX_ITERATIONS) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("PASS\n");
+
+    return 0;
+}
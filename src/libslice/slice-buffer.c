@@ -1,63 +1,354 @@
-
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "slice-buffer.h"
 
+struct slice_buffer_pool_class
+{
+    unsigned int size;
+
+    SliceBuffer *free_list;         // linked through obj.next
+    int count;
+    int max;
+
+    SliceBuffer *arena_list;        // arena buffers are always cached, they can't be freed
+    int arena_count;
+
+    int in_use;
+    int high_water;
+
+    unsigned long long hits;
+    unsigned long long misses;
+};
+
+struct slice_buffer_pool
+{
+    struct slice_buffer_pool_class classes[SLICE_BUFFER_POOL_CLASS_COUNT];
+
+    unsigned long long large_allocs;
+
+    SliceBuffer *header_list;       // size 0 entries, linked through obj.next
+    int header_count;
+
+    char *arena;
+    size_t arena_size;
+    size_t arena_used;
+    int arena_hugetlb;
+};
+
+static const unsigned int slice_buffer_pool_class_size[SLICE_BUFFER_POOL_CLASS_COUNT] = {
+    2 * 1024, 8 * 1024, 32 * 1024, 128 * 1024, 1024 * 1024
+};
+
+static const int slice_buffer_pool_class_max[SLICE_BUFFER_POOL_CLASS_COUNT] = {
+    256, 128, 64, 16, 4
+};
+
+// smallest class holding size bytes plus the terminator, -1 for large buffers
+static int slice_buffer_pool_class_index(unsigned int size)
+{
+    int i;
+
+    for (i = 0; i < SLICE_BUFFER_POOL_CLASS_COUNT; i++) {
+        if (size <= slice_buffer_pool_class_size[i]) return i;
+    }
+
+    return -1;
+}
+
+// class a buffer was carved for, -1 for large or foreign sizes
+static int slice_buffer_pool_class_of(SliceBuffer *buffer)
+{
+    int i;
+
+    for (i = 0; i < SLICE_BUFFER_POOL_CLASS_COUNT; i++) {
+        if (buffer->size == slice_buffer_pool_class_size[i]) return i;
+    }
+
+    return -1;
+}
+
+static SliceBuffer *slice_buffer_alloc(unsigned int size, char *err)
+{
+    SliceBuffer *buffer;
+
+    if (!(buffer = (SliceBuffer*)malloc((size_t)(sizeof(SliceBuffer) + size)))) {
+        if (err) sprintf(err, "Can't allocate buffer memory");
+        return NULL;
+    }
+
+    memset(buffer, 0, sizeof(SliceBuffer));
+    buffer->size = size;
+
+    return buffer;
+}
+
+static int slice_buffer_pool_arena_owns(SliceBufferPool *pool, SliceBuffer *buffer)
+{
+    return (pool->arena && (char*)buffer >= pool->arena && (char*)buffer < pool->arena + pool->arena_size) ? 1 : 0;
+}
+
+// bump allocation, the region is never given back before the pool goes away
+static SliceBuffer *slice_buffer_arena_alloc(SliceBufferPool *pool, unsigned int size)
+{
+    SliceBuffer *buffer;
+    size_t need;
+
+    if (!pool->arena) return NULL;
+
+    // cache line aligned so neighbouring buffers don't share lines
+    need = (sizeof(SliceBuffer) + size + 63) & ~((size_t)63);
+
+    if (pool->arena_size - pool->arena_used < need) return NULL;
+
+    buffer = (SliceBuffer*)(pool->arena + pool->arena_used);
+    pool->arena_used += need;
+
+    memset(buffer, 0, sizeof(SliceBuffer));
+    buffer->size = size;
+    buffer->arena = 1;
+
+    return buffer;
+}
+
+SliceBufferPool *slice_buffer_pool_create(char *err)
+{
+    SliceBufferPool *pool;
+    int i;
+
+    if (!(pool = (SliceBufferPool*)malloc(sizeof(SliceBufferPool)))) {
+        if (err) sprintf(err, "Can't allocate buffer pool memory");
+        return NULL;
+    }
+
+    memset(pool, 0, sizeof(SliceBufferPool));
+
+    for (i = 0; i < SLICE_BUFFER_POOL_CLASS_COUNT; i++) {
+        pool->classes[i].size = slice_buffer_pool_class_size[i];
+        pool->classes[i].max = slice_buffer_pool_class_max[i];
+    }
+
+    return pool;
+}
+
+SliceReturnType slice_buffer_pool_destroy(SliceBufferPool *pool, char *err)
+{
+    SliceBuffer *buffer;
+    int i;
+
+    if (!pool) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    for (i = 0; i < SLICE_BUFFER_POOL_CLASS_COUNT; i++) {
+        while ((buffer = pool->classes[i].free_list)) {
+            pool->classes[i].free_list = (SliceBuffer*)buffer->obj.next;
+            free(buffer);
+        }
+    }
+
+    while ((buffer = pool->header_list)) {
+        pool->header_list = (SliceBuffer*)buffer->obj.next;
+        free(buffer);
+    }
+
+    if (pool->arena) munmap(pool->arena, pool->arena_size);
+
+    free(pool);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// cap of cached buffers for the class serving size, 0 disables caching for it
+SliceReturnType slice_buffer_pool_set_max(SliceBufferPool *pool, unsigned int size, int max, char *err)
+{
+    struct slice_buffer_pool_class *pool_class;
+    SliceBuffer *buffer;
+    int index;
+
+    if (!pool || max < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if ((index = slice_buffer_pool_class_index(size)) < 0) {
+        if (err) sprintf(err, "Size [%u] is over the largest class, large buffers are not cached", size);
+        return SLICE_RETURN_ERROR;
+    }
+
+    pool_class = &(pool->classes[index]);
+    pool_class->max = max;
+
+    while (pool_class->count > max && (buffer = pool_class->free_list)) {
+        pool_class->free_list = (SliceBuffer*)buffer->obj.next;
+        pool_class->count--;
+        free(buffer);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// map and prefault size bytes for class buffers, hugetlb pages when reserved, THP advised pages otherwise
+SliceReturnType slice_buffer_pool_set_arena(SliceBufferPool *pool, unsigned long long size, char *err)
+{
+    size_t length, page, offset;
+    char *arena;
+    int hugetlb = 1;
+
+    if (!pool || size == 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (pool->arena) {
+        if (err) sprintf(err, "Buffer arena is already set");
+        return SLICE_RETURN_ERROR;
+    }
+
+    length = (size_t)(((size + SLICE_BUFFER_ARENA_STEP - 1) / SLICE_BUFFER_ARENA_STEP) * SLICE_BUFFER_ARENA_STEP);
+
+#ifdef MAP_HUGETLB
+    arena = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+#else
+    arena = (char*)MAP_FAILED;
+#endif
+
+    if (arena == (char*)MAP_FAILED) {
+        hugetlb = 0;
+
+        if ((arena = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == (char*)MAP_FAILED) {
+            if (err) sprintf(err, "mmap return error [%s]", strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+
+#ifdef MADV_HUGEPAGE
+        // advice only, THP may be disabled
+        madvise(arena, length, MADV_HUGEPAGE);
+#endif
+
+        // touch every page now so the first requests don't take the faults
+        page = (size_t)sysconf(_SC_PAGESIZE);
+        for (offset = 0; offset < length; offset += page) arena[offset] = 0;
+    }
+
+    pool->arena = arena;
+    pool->arena_size = length;
+    pool->arena_used = 0;
+    pool->arena_hugetlb = hugetlb;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_buffer_pool_get_stats(SliceBufferPool *pool, SliceBufferPoolStats *stats, char *err)
+{
+    int i;
+
+    if (!pool || !stats) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    memset(stats, 0, sizeof(SliceBufferPoolStats));
+
+    for (i = 0; i < SLICE_BUFFER_POOL_CLASS_COUNT; i++) {
+        stats->classes[i].size = pool->classes[i].size;
+        stats->classes[i].max = pool->classes[i].max;
+        stats->classes[i].count = pool->classes[i].count + pool->classes[i].arena_count;
+        stats->classes[i].in_use = pool->classes[i].in_use;
+        stats->classes[i].high_water = pool->classes[i].high_water;
+        stats->classes[i].hits = pool->classes[i].hits;
+        stats->classes[i].misses = pool->classes[i].misses;
+    }
+
+    stats->large_allocs = pool->large_allocs;
+
+    stats->arena_size = pool->arena_size;
+    stats->arena_used = pool->arena_used;
+    stats->arena_hugetlb = pool->arena_hugetlb;
+
+    return SLICE_RETURN_NORMAL;
+}
+
 SliceBuffer *slice_buffer_create(SliceMainloop *mainloop, unsigned int size, char *err)
 {
-    SliceBuffer *buffer = NULL, *tmp, *buffer_bucket, *new_buff;
-    unsigned int adj_size;
+    struct slice_buffer_pool_class *pool_class;
+    SliceBufferPool *pool;
+    SliceBuffer *buffer;
+    int index;
 
     if (size == 0) size = 1;
 
-    adj_size = ((size / SLICE_BUFFER_BLOCK_SIZE) + 1) * SLICE_BUFFER_BLOCK_SIZE;
+    pool = (mainloop) ? SliceMainloopGetBufferPool(mainloop) : NULL;
 
-    if (mainloop && (tmp = buffer_bucket = SliceMainloopGetBufferBucket(mainloop))) {
-        do {
-            if (tmp->size >= adj_size) break;
+    if ((index = slice_buffer_pool_class_index(size)) < 0) {
+        if (pool) pool->large_allocs++;
+        return slice_buffer_alloc(((size / SLICE_BUFFER_POOL_LARGE_STEP) + 1) * SLICE_BUFFER_POOL_LARGE_STEP, err);
+    }
 
-            tmp = (SliceBuffer*)tmp->obj.next;
-        } while(tmp != buffer_bucket);
+    if (!pool) return slice_buffer_alloc(slice_buffer_pool_class_size[index], err);
 
-        SliceMainloopBufferBucketRemove(mainloop, tmp, NULL);
-        buffer = tmp;
+    pool_class = &(pool->classes[index]);
 
-        if (buffer->size < adj_size) {
-            //printf("realloc 1 [%lu]\n", (size_t)(sizeof(SliceBuffer) + adj_size));
-            if (!(new_buff = (SliceBuffer*)realloc(buffer, (size_t)(sizeof(SliceBuffer) + adj_size)))) {
-                if (err) sprintf(err, "Can't re-allocate buffer memory");
-                free(buffer);
-                return NULL;
-            }
+    // arena buffers first, their pages are already faulted in
+    if ((buffer = pool_class->arena_list)) {
+        pool_class->arena_list = (SliceBuffer*)buffer->obj.next;
+        pool_class->arena_count--;
+    } else if ((buffer = pool_class->free_list)) {
+        pool_class->free_list = (SliceBuffer*)buffer->obj.next;
+        pool_class->count--;
+    }
 
-            buffer = new_buff;
-        }
+    if (buffer) {
+        pool_class->hits++;
 
-        buffer->size = adj_size;
+        buffer->obj.next = NULL;
         buffer->length = 0;
         buffer->current = 0;
+        buffer->zerocopy_seq = 0;
+        buffer->source = SLICE_BUFFER_SOURCE_DATA;
+        buffer->source_buffer = NULL;
+        buffer->refcount = 0;
         buffer->data[0] = 0;
     } else {
-        //printf("malloc [%lu]\n", (size_t)(sizeof(SliceBuffer) + adj_size));
-        if (!(buffer = (SliceBuffer*)malloc((size_t)(sizeof(SliceBuffer) + adj_size)))) {
-            if (err) sprintf(err, "Can't allocate buffer memory");
-            return NULL;
-        }
+        pool_class->misses++;
 
-        memset(buffer, 0, sizeof(SliceBuffer));
-        buffer->data[0] = 0;
-        buffer->size = adj_size;
+        if (!(buffer = slice_buffer_arena_alloc(pool, pool_class->size)) && !(buffer = slice_buffer_alloc(pool_class->size, err))) return NULL;
     }
 
+    if (++(pool_class->in_use) > pool_class->high_water) pool_class->high_water = pool_class->in_use;
+
+    return buffer;
+}
+
+// an entry with no data of its own, size 0, for a write queue pointing at another buffer
+SliceBuffer *slice_buffer_create_header(SliceMainloop *mainloop, char *err)
+{
+    SliceBufferPool *pool;
+    SliceBuffer *buffer;
+
+    pool = (mainloop) ? SliceMainloopGetBufferPool(mainloop) : NULL;
+
+    if (!pool || !(buffer = pool->header_list)) return slice_buffer_alloc(0, err);
+
+    pool->header_list = (SliceBuffer*)buffer->obj.next;
+    pool->header_count--;
+
+    memset(buffer, 0, sizeof(SliceBuffer));
+
     return buffer;
 }
 
 SliceReturnType slice_buffer_prepare(SliceMainloop *mainloop, SliceBuffer **buffer, unsigned int need_size, char *err)
 {
+    SliceBufferPool *pool;
     SliceBuffer *new_buff;
     unsigned int adj_size;
+    int index;
 
     if (!buffer || need_size == 0) {
         if (err) sprintf(err, "Invalid parameter");
@@ -74,18 +365,49 @@ SliceReturnType slice_buffer_prepare(SliceMainloop *mainloop, SliceBuffer **buff
             return SLICE_RETURN_ERROR;
         }
 
+        if ((*buffer)->refcount > 0) {
+            if (err) sprintf(err, "Can't re-allocate buffer while it is shared");
+            return SLICE_RETURN_ERROR;
+        }
+
         need_size += (*buffer)->length;
 
-        adj_size = ((need_size / SLICE_BUFFER_BLOCK_SIZE) + 1) * SLICE_BUFFER_BLOCK_SIZE;
+        if (slice_buffer_pool_class_index(need_size) >= 0) {
+            // move up a class, the old buffer goes back to its free list
+            if (!(new_buff = slice_buffer_create(mainloop, need_size, err))) return SLICE_RETURN_ERROR;
 
-        //printf("realloc 2 [%lu]\n", (size_t)(sizeof(SliceBuffer) + adj_size));
-        if (!(new_buff = (SliceBuffer*)realloc((*buffer), (size_t)(sizeof(SliceBuffer) + adj_size)))) {
-            if (err) sprintf(err, "Can't re-allocate buffer memory");
-            return SLICE_RETURN_ERROR;
-        }
+            memcpy(new_buff->data, (*buffer)->data, (*buffer)->length + 1);
+            new_buff->length = (*buffer)->length;
+            new_buff->current = (*buffer)->current;
+
+            slice_buffer_release(mainloop, buffer, NULL);
+        } else {
+            adj_size = ((need_size / SLICE_BUFFER_POOL_LARGE_STEP) + 1) * SLICE_BUFFER_POOL_LARGE_STEP;
+
+            if ((*buffer)->arena) {
+                // arena memory can't be realloc'ed, copy out and hand the slot back
+                if (!(new_buff = slice_buffer_alloc(adj_size, err))) return SLICE_RETURN_ERROR;
 
-        new_buff->data[new_buff->length] = 0;
-        new_buff->size = adj_size;
+                memcpy(new_buff->data, (*buffer)->data, (*buffer)->length + 1);
+                new_buff->length = (*buffer)->length;
+                new_buff->current = (*buffer)->current;
+
+                slice_buffer_release(mainloop, buffer, NULL);
+            } else {
+                // a pooled buffer leaves its class here
+                if ((pool = (mainloop) ? SliceMainloopGetBufferPool(mainloop) : NULL) && (index = slice_buffer_pool_class_of(*buffer)) >= 0 && pool->classes[index].in_use > 0) {
+                    pool->classes[index].in_use--;
+                }
+
+                if (!(new_buff = (SliceBuffer*)realloc((*buffer), (size_t)(sizeof(SliceBuffer) + adj_size)))) {
+                    if (err) sprintf(err, "Can't re-allocate buffer memory");
+                    return SLICE_RETURN_ERROR;
+                }
+
+                new_buff->data[new_buff->length] = 0;
+                new_buff->size = adj_size;
+            }
+        }
 
         (*buffer) = new_buff;
     }
@@ -95,6 +417,10 @@ SliceReturnType slice_buffer_prepare(SliceMainloop *mainloop, SliceBuffer **buff
 
 SliceReturnType slice_buffer_release(SliceMainloop *mainloop, SliceBuffer **buffer, char *err)
 {
+    struct slice_buffer_pool_class *pool_class;
+    SliceBufferPool *pool;
+    int index;
+
     if (!buffer || !(*buffer)) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
@@ -105,8 +431,59 @@ SliceReturnType slice_buffer_release(SliceMainloop *mainloop, SliceBuffer **buff
         return SLICE_RETURN_ERROR;
     }
 
-    if (mainloop && SliceMainloopGetBufferBucketCount(mainloop) < SLICE_BUFFER_BUCKET_MAX) {
-        SliceMainloopBufferBucketAdd(mainloop, (*buffer), NULL);
+    // shared buffers go back with their last reference
+    if ((*buffer)->refcount > 0) {
+        (*buffer)->refcount--;
+        (*buffer) = NULL;
+        return SLICE_RETURN_NORMAL;
+    }
+
+    pool = (mainloop) ? SliceMainloopGetBufferPool(mainloop) : NULL;
+
+    // the next owner could overwrite pages still queued in the kernel, an arena slot just stays unused
+    if ((*buffer)->pinned) {
+        if (pool && (index = slice_buffer_pool_class_of(*buffer)) >= 0 && (!(*buffer)->arena || slice_buffer_pool_arena_owns(pool, *buffer))) {
+            if (pool->classes[index].in_use > 0) pool->classes[index].in_use--;
+        }
+
+        if (!(*buffer)->arena) free(*buffer);
+        (*buffer) = NULL;
+        return SLICE_RETURN_NORMAL;
+    }
+
+    if ((*buffer)->size == 0 && pool && pool->header_count < SLICE_BUFFER_POOL_HEADER_MAX) {
+        (*buffer)->obj.next = (SliceObject*)pool->header_list;
+        pool->header_list = (*buffer);
+        pool->header_count++;
+        (*buffer) = NULL;
+        return SLICE_RETURN_NORMAL;
+    }
+
+    if ((*buffer)->arena && !(pool && slice_buffer_pool_arena_owns(pool, *buffer))) {
+        // released without its loop, the slot stays unused until the arena goes away
+        (*buffer) = NULL;
+        return SLICE_RETURN_NORMAL;
+    }
+
+    if (!pool || (index = slice_buffer_pool_class_of(*buffer)) < 0) {
+        free(*buffer);
+        (*buffer) = NULL;
+        return SLICE_RETURN_NORMAL;
+    }
+
+    pool_class = &(pool->classes[index]);
+
+    // created without a loop or on another one
+    if (pool_class->in_use > 0) pool_class->in_use--;
+
+    if ((*buffer)->arena) {
+        (*buffer)->obj.next = (SliceObject*)pool_class->arena_list;
+        pool_class->arena_list = (*buffer);
+        pool_class->arena_count++;
+    } else if (pool_class->count < pool_class->max) {
+        (*buffer)->obj.next = (SliceObject*)pool_class->free_list;
+        pool_class->free_list = (*buffer);
+        pool_class->count++;
     } else {
         free(*buffer);
     }
@@ -115,3 +492,29 @@ SliceReturnType slice_buffer_release(SliceMainloop *mainloop, SliceBuffer **buff
 
     return SLICE_RETURN_NORMAL;
 }
+
+// release data the kernel may still read, it leaves the pool for good, with the last reference if shared
+SliceReturnType slice_buffer_discard(SliceMainloop *mainloop, SliceBuffer **buffer, char *err)
+{
+    if (!buffer || !(*buffer)) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    (*buffer)->pinned = 1;
+
+    return slice_buffer_release(mainloop, buffer, err);
+}
+
+// one more reference, each SliceBufferRelease drops one, loop local like the pool it comes from
+SliceReturnType slice_buffer_retain(SliceBuffer *buffer, char *err)
+{
+    if (!buffer) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    buffer->refcount++;
+
+    return SLICE_RETURN_NORMAL;
+}
@@ -5,13 +5,35 @@
 #include "slice-object.h"
 
 #define SLICE_BUFFER_BLOCK_SIZE             (32 * 1024)
-#define SLICE_BUFFER_BUCKET_MAX             64
+
+// per loop free lists of 2K / 8K / 32K / 128K / 1M, larger buffers are plain heap blocks in 1M steps
+#define SLICE_BUFFER_POOL_CLASS_COUNT       5
+#define SLICE_BUFFER_POOL_LARGE_STEP        (1024 * 1024)
+
+// header-only entries cached per loop, queue entries pointing at data owned by another buffer
+#define SLICE_BUFFER_POOL_HEADER_MAX        1024
+
+// optional per loop arena, class buffers are carved from one prefaulted region in 2M hugepage steps
+#define SLICE_BUFFER_ARENA_STEP             (2 * 1024 * 1024)
 
 typedef struct slice_buffer SliceBuffer;
+typedef struct slice_buffer_pool SliceBufferPool;
+typedef struct slice_buffer_pool_stats SliceBufferPoolStats;
+
+typedef enum slice_buffer_source SliceBufferSource;
 
 // loop struct definetion
 typedef struct slice_mainloop SliceMainloop;
 
+// where a write queue entry takes its bytes from
+enum slice_buffer_source
+{
+    SLICE_BUFFER_SOURCE_DATA = 0,   // data[]
+    SLICE_BUFFER_SOURCE_FILE,       // regular file range, sendfile
+    SLICE_BUFFER_SOURCE_PIPE,       // pipe contents, splice
+    SLICE_BUFFER_SOURCE_SHARED      // data[] of source_buffer, referenced by many queues
+};
+
 struct slice_buffer
 {
     SliceObject obj;
@@ -19,23 +41,74 @@ struct slice_buffer
     unsigned int size;
     unsigned int length;
     unsigned int current;
+    unsigned int zerocopy_seq;      // last MSG_ZEROCOPY send reading the data plus one, 0 when never pinned
+
+    // file and pipe entries send length bytes of source_fd, the queue owns the descriptor
+    SliceBufferSource source;
+    int source_fd;
+    unsigned long long source_offset;
+    SliceBuffer *source_buffer;     // shared entries hold one reference
+
+    int refcount;                   // references beyond the owner's, the data is read-only while above 0
+    int arena;                      // carved from a loop arena, never handed to free()
+    int pinned;                     // the kernel may still read the data, the last release drops it instead of recycling
+
     char data[1];
 };
 
+struct slice_buffer_pool_stats
+{
+    struct
+    {
+        unsigned int size;
+        int max;                    // cached buffers kept at most
+        int count;                  // cached now
+        int in_use;
+        int high_water;             // highest in_use seen
+
+        unsigned long long hits;
+        unsigned long long misses;
+    } classes[SLICE_BUFFER_POOL_CLASS_COUNT];
+
+    unsigned long long large_allocs;
+
+    unsigned long long arena_size;  // 0 without an arena
+    unsigned long long arena_used;
+    int arena_hugetlb;              // MAP_HUGETLB pages, otherwise THP advised
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 SliceBuffer *slice_buffer_create(SliceMainloop *mainloop, unsigned int size, char *err);
+SliceBuffer *slice_buffer_create_header(SliceMainloop *mainloop, char *err);
 SliceReturnType slice_buffer_prepare(SliceMainloop *mainloop, SliceBuffer **buff, unsigned int need_size, char *err);
 SliceReturnType slice_buffer_release(SliceMainloop *mainloop, SliceBuffer **buff, char *err);
+SliceReturnType slice_buffer_retain(SliceBuffer *buffer, char *err);
+SliceReturnType slice_buffer_discard(SliceMainloop *mainloop, SliceBuffer **buff, char *err);
+
+SliceBufferPool *slice_buffer_pool_create(char *err);
+SliceReturnType slice_buffer_pool_destroy(SliceBufferPool *pool, char *err);
+SliceReturnType slice_buffer_pool_set_max(SliceBufferPool *pool, unsigned int size, int max, char *err);
+SliceReturnType slice_buffer_pool_set_arena(SliceBufferPool *pool, unsigned long long size, char *err);
+SliceReturnType slice_buffer_pool_get_stats(SliceBufferPool *pool, SliceBufferPoolStats *stats, char *err);
 
 #ifdef __cplusplus
 }
 #endif
 
 #define SliceBufferCreate(_mainloop, _size, _err) slice_buffer_create(_mainloop, _size, _err)
+#define SliceBufferCreateHeader(_mainloop, _err) slice_buffer_create_header(_mainloop, _err)
 #define SliceBufferPrepare(_mainloop, _buff, _need_size, _err) slice_buffer_prepare(_mainloop, (SliceBuffer**)_buff, _need_size, _err)
 #define SliceBufferRelease(_mainloop, _buff, _err) slice_buffer_release(_mainloop, _buff, _err)
+#define SliceBufferRetain(_buffer, _err) slice_buffer_retain(_buffer, _err)
+#define SliceBufferDiscard(_mainloop, _buff, _err) slice_buffer_discard(_mainloop, _buff, _err)
+
+#define SliceBufferPoolCreate(_err) slice_buffer_pool_create(_err)
+#define SliceBufferPoolDestroy(_pool, _err) slice_buffer_pool_destroy(_pool, _err)
+#define SliceBufferPoolSetMax(_pool, _size, _max, _err) slice_buffer_pool_set_max(_pool, _size, _max, _err)
+#define SliceBufferPoolSetArena(_pool, _size, _err) slice_buffer_pool_set_arena(_pool, _size, _err)
+#define SliceBufferPoolGetStats(_pool, _stats, _err) slice_buffer_pool_get_stats(_pool, _stats, _err)
 
 #endif
@@ -42,6 +42,10 @@ SliceReturnType slice_client_remove(SliceClient *client, char *err)
     if (mainloop_event->destroyed) return SLICE_RETURN_NORMAL;
     mainloop_event->destroyed = 1;
 
+    // while the event is still attached, its buffers and watches belong to this loop
+    if (client->connection) SliceConnectionDetach(client->connection, NULL);
+
+    // out of the interest set before the fd is closed, its number may be reused by another loop right away
     if (SliceMainloopEventRemove(client->mainloop_event.mainloop, client, err_buff) != SLICE_RETURN_NORMAL) {
         if (err) sprintf(err, "SliceMainloopEventRemove return error [%s]", err_buff);
         return SLICE_RETURN_ERROR;
@@ -183,15 +187,18 @@ static SliceReturnType slice_client_read_callback(SliceMainloopEpoll *epoll, Sli
 
     if ((ret = slice_connection_socket_read(client->connection, &r, err_buff)) == SLICE_RETURN_ERROR) {
         printf("slice_connection_socket_read return error [%s]\n", err_buff);
-        slice_client_remove(client, NULL);
-        free(client);
-        return SLICE_RETURN_ERROR;
-    } else if (ret == SLICE_RETURN_INFO) {
-        return SLICE_RETURN_NORMAL;
+    } else if (ret == SLICE_RETURN_NORMAL && r > 0 && client->read_callback(client, r, client->mainloop_event.user_data, "read") != 0) {
+        printf("client read callback return error\n");
+        ret = SLICE_RETURN_ERROR;
     }
 
-    if (r > 0 && client->read_callback(client, r, client->mainloop_event.user_data, "read") != 0) {
-        printf("client read callback return error\n");
+    // the loop scratch is lent for this round only, it goes back here whatever the read and the callback returned
+    if (slice_connection_socket_read_done(client->connection, err_buff) != SLICE_RETURN_NORMAL) {
+        printf("slice_connection_socket_read_done return error [%s]\n", err_buff);
+        ret = SLICE_RETURN_ERROR;
+    }
+
+    if (ret == SLICE_RETURN_ERROR) {
         slice_client_remove(client, NULL);
         free(client);
         return SLICE_RETURN_ERROR;
@@ -224,6 +231,30 @@ static SliceReturnType slice_client_write_callback(SliceMainloopEpoll *epoll, Sl
     return SLICE_RETURN_NORMAL;
 }
 
+// EPOLLERR also reports zero-copy completions queued on the socket error queue
+static SliceReturnType slice_client_close_callback(SliceMainloopEpoll *epoll, SliceMainloopEpollElement *element, struct epoll_event ev, void *user_data)
+{
+    SliceClient *client;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!epoll || !element) {
+        return SLICE_RETURN_ERROR;
+    }
+
+    client = (SliceClient*)SliceMainloopEpollElementGetSliceMainloopEvent(element);
+
+    if (!client) return SLICE_RETURN_ERROR;
+
+    if (SliceConnectionZerocopyComplete(client->connection, err_buff) < 0) {
+        printf("SliceConnectionZerocopyComplete return error [%s]\n", err_buff);
+        slice_client_remove(client, NULL);
+        free(client);
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
 SliceReturnType slice_client_start(SliceClient *client, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceClient*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err)
 {
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
@@ -251,6 +282,13 @@ SliceReturnType slice_client_start(SliceClient *client, SliceSSLContext *ssl_ctx
     SliceMainloopEpollEventAddRead(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
 
     SliceMainloopEpollEventSetCallback(client->mainloop_event.mainloop, client->mainloop_event.io.fd, SLICE_MAINLOOP_EPOLL_EVENT_WRITE, slice_client_write_callback, NULL);
+    SliceMainloopEpollEventSetCallback(client->mainloop_event.mainloop, client->mainloop_event.io.fd, SLICE_MAINLOOP_EPOLL_EVENT_CLOSE, slice_client_close_callback, NULL);
+
+    // connected, a plain socket reads and writes through completion requests on an io_uring loop
+    if (SliceConnectionSetCompletion(client->connection, err_buff) == SLICE_RETURN_ERROR) {
+        if (err) sprintf(err, "SliceConnectionSetCompletion return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
 
     if (ssl_ctx) {
         if (SliceSSLClientConnect(client->mainloop_event.io.fd, ssl_ctx, err_buff) < 0) {
@@ -276,7 +314,84 @@ SliceReturnType slice_client_write(SliceClient *client, SliceBuffer *buffer, cha
         return SLICE_RETURN_ERROR;
     }
 
-    SliceMainloopEpollEventAddWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    // the write callback checks the connect result until slice_client_start
+    if (client->read_callback) {
+        SliceMainloopEpollEventFlushWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    } else {
+        SliceMainloopEpollEventAddWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_client_writev(SliceClient *client, const struct iovec *iov, int iovcnt, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!client || !iov) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (SliceConnectionWritev(client->connection, iov, iovcnt, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceConnectionWritev return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    // the write callback checks the connect result until slice_client_start
+    if (client->read_callback) {
+        SliceMainloopEpollEventFlushWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    } else {
+        SliceMainloopEpollEventAddWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_client_write_shared(SliceClient *client, SliceBuffer *buffer, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!client || !buffer) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (SliceConnectionWriteShared(client->connection, buffer, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceConnectionWriteShared return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    // the write callback checks the connect result until slice_client_start
+    if (client->read_callback) {
+        SliceMainloopEpollEventFlushWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    } else {
+        SliceMainloopEpollEventAddWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_client_write_file(SliceClient *client, int fd, unsigned long long offset, unsigned int length, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (SliceConnectionWriteFile(client->connection, fd, offset, length, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceConnectionWriteFile return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    // the write callback checks the connect result until slice_client_start
+    if (client->read_callback) {
+        SliceMainloopEpollEventFlushWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    } else {
+        SliceMainloopEpollEventAddWrite(client->mainloop_event.mainloop, client->mainloop_event.io.fd, NULL);
+    }
 
     return SLICE_RETURN_NORMAL;
 }
@@ -382,6 +497,63 @@ int slice_client_fetch_read_buffer(SliceClient *client, char *out, unsigned int
     return SliceConnectionFetchReadBuffer(client->connection, out, out_size, err);
 }
 
+SliceReturnType slice_client_peek_read_buffer(SliceClient *client, char **data, unsigned int *length, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionPeekReadBuffer(client->connection, data, length, err);
+}
+
+SliceReturnType slice_client_consume_read_buffer(SliceClient *client, unsigned int length, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionConsumeReadBuffer(client->connection, length, err);
+}
+
+SliceReturnType slice_client_set_read_segmented(SliceClient *client, int enable, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetReadSegmented(client->connection, enable, err);
+}
+
+int slice_client_peek_read_iovec(SliceClient *client, struct iovec *iov, int iovcnt, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return -1;
+    }
+
+    return SliceConnectionPeekReadIovec(client->connection, iov, iovcnt, err);
+}
+
+SliceReturnType slice_client_set_read_scratch(SliceClient *client, int enable, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetReadScratch(client->connection, enable, err);
+}
+
+unsigned long long slice_client_get_read_length(SliceClient *client)
+{
+    if (!client) return 0;
+
+    return SliceConnectionGetReadLength(client->connection);
+}
+
 SliceBuffer *slice_client_get_read_buffer(SliceClient *client)
 {
     if (!client) return NULL;
@@ -398,3 +570,80 @@ SliceReturnType slice_client_clear_read_buffer(SliceClient *client, char *err)
 
     return SliceConnectionClearReadBuffer(client->connection, err);
 }
+
+SliceReturnType slice_client_set_timeout(SliceClient *client, SliceConnectionTimeout type, unsigned int timeout, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetTimeout(client->connection, type, timeout, err);
+}
+
+SliceReturnType slice_client_set_read_budget(SliceClient *client, unsigned int budget, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetReadBudget(client->connection, budget, err);
+}
+
+SliceReturnType slice_client_set_busy_poll(SliceClient *client, unsigned int usec, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetBusyPoll(client->connection, usec, err);
+}
+
+SliceReturnType slice_client_set_zerocopy(SliceClient *client, unsigned int threshold, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetZerocopy(client->connection, threshold, err);
+}
+
+SliceReturnType slice_client_set_write_watermark(SliceClient *client, unsigned long long high, unsigned long long low, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetWriteWatermark(client->connection, high, low, err);
+}
+
+SliceReturnType slice_client_set_write_callback(SliceClient *client, void(*write_blocked_callback)(SliceConnection*, void*), void(*write_drained_callback)(SliceConnection*, void*), char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetWriteCallback(client->connection, write_blocked_callback, write_drained_callback, err);
+}
+
+SliceReturnType slice_client_set_write_peer(SliceClient *client, SliceConnection *peer, char *err)
+{
+    if (!client) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetWritePeer(client->connection, peer, err);
+}
+
+SliceConnection *slice_client_get_connection(SliceClient *client)
+{
+    if (!client) return NULL;
+
+    return client->connection;
+}
@@ -13,9 +13,26 @@ SliceClient *slice_client_create(SliceMainloop *mainloop, char *host, int port,
 SliceReturnType slice_client_remove(SliceClient *client, char *err);
 SliceReturnType slice_client_start(SliceClient *client, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceClient*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err);
 SliceReturnType slice_client_write(SliceClient *client, SliceBuffer *buffer, char *err);
+SliceReturnType slice_client_writev(SliceClient *client, const struct iovec *iov, int iovcnt, char *err);
+SliceReturnType slice_client_write_shared(SliceClient *client, SliceBuffer *buffer, char *err);
+SliceReturnType slice_client_write_file(SliceClient *client, int fd, unsigned long long offset, unsigned int length, char *err);
 int slice_client_fetch_read_buffer(SliceClient *client, char *out, unsigned int out_size, char *err);
+SliceReturnType slice_client_peek_read_buffer(SliceClient *client, char **data, unsigned int *length, char *err);
+SliceReturnType slice_client_consume_read_buffer(SliceClient *client, unsigned int length, char *err);
+SliceReturnType slice_client_set_read_segmented(SliceClient *client, int enable, char *err);
+int slice_client_peek_read_iovec(SliceClient *client, struct iovec *iov, int iovcnt, char *err);
+unsigned long long slice_client_get_read_length(SliceClient *client);
+SliceReturnType slice_client_set_read_scratch(SliceClient *client, int enable, char *err);
 SliceBuffer *slice_client_get_read_buffer(SliceClient *client);
 SliceReturnType slice_client_clear_read_buffer(SliceClient *client, char *err);
+SliceReturnType slice_client_set_timeout(SliceClient *client, SliceConnectionTimeout type, unsigned int timeout, char *err);
+SliceReturnType slice_client_set_read_budget(SliceClient *client, unsigned int budget, char *err);
+SliceReturnType slice_client_set_busy_poll(SliceClient *client, unsigned int usec, char *err);
+SliceReturnType slice_client_set_zerocopy(SliceClient *client, unsigned int threshold, char *err);
+SliceReturnType slice_client_set_write_watermark(SliceClient *client, unsigned long long high, unsigned long long low, char *err);
+SliceReturnType slice_client_set_write_callback(SliceClient *client, void(*write_blocked_callback)(SliceConnection*, void*), void(*write_drained_callback)(SliceConnection*, void*), char *err);
+SliceReturnType slice_client_set_write_peer(SliceClient *client, SliceConnection *peer, char *err);
+SliceConnection *slice_client_get_connection(SliceClient *client);
 
 #ifdef __cplusplus
 }
@@ -25,8 +42,25 @@ SliceReturnType slice_client_clear_read_buffer(SliceClient *client, char *err);
 #define SliceClientRemove(_client, _err) slice_client_remove(_client, _err)
 #define SliceClientStart(_client, _ssl_ctx, _read_callback, _close_callback, _user_data, _err) slice_client_start(_client, _ssl_ctx, _read_callback, _close_callback, _user_data, _err)
 #define SliceClientWrite(_client, _buffer, _err) slice_client_write(_client, _buffer, _err)
+#define SliceClientWritev(_client, _iov, _iovcnt, _err) slice_client_writev(_client, _iov, _iovcnt, _err)
+#define SliceClientWriteShared(_client, _buffer, _err) slice_client_write_shared(_client, _buffer, _err)
+#define SliceClientWriteFile(_client, _fd, _offset, _length, _err) slice_client_write_file(_client, _fd, _offset, _length, _err)
 #define SliceClientFetchReadBuffer(_client, _out, _out_size, _err) slice_client_fetch_read_buffer(_client, _out, _out_size, _err)
+#define SliceClientPeekReadBuffer(_client, _data, _length, _err) slice_client_peek_read_buffer(_client, _data, _length, _err)
+#define SliceClientConsumeReadBuffer(_client, _length, _err) slice_client_consume_read_buffer(_client, _length, _err)
+#define SliceClientSetReadSegmented(_client, _enable, _err) slice_client_set_read_segmented(_client, _enable, _err)
+#define SliceClientPeekReadIovec(_client, _iov, _iovcnt, _err) slice_client_peek_read_iovec(_client, _iov, _iovcnt, _err)
+#define SliceClientGetReadLength(_client) slice_client_get_read_length(_client)
+#define SliceClientSetReadScratch(_client, _enable, _err) slice_client_set_read_scratch(_client, _enable, _err)
 #define SliceClientGetReadBuffer(_client) slice_client_get_read_buffer(_client)
 #define SliceClientClearReadBuffer(_client, _err) slice_client_clear_read_buffer(_client, _err)
+#define SliceClientSetTimeout(_client, _type, _timeout, _err) slice_client_set_timeout(_client, _type, _timeout, _err)
+#define SliceClientSetReadBudget(_client, _budget, _err) slice_client_set_read_budget(_client, _budget, _err)
+#define SliceClientSetBusyPoll(_client, _usec, _err) slice_client_set_busy_poll(_client, _usec, _err)
+#define SliceClientSetZerocopy(_client, _threshold, _err) slice_client_set_zerocopy(_client, _threshold, _err)
+#define SliceClientSetWriteWatermark(_client, _high, _low, _err) slice_client_set_write_watermark(_client, _high, _low, _err)
+#define SliceClientSetWriteCallback(_client, _blocked_callback, _drained_callback, _err) slice_client_set_write_callback(_client, _blocked_callback, _drained_callback, _err)
+#define SliceClientSetWritePeer(_client, _peer, _err) slice_client_set_write_peer(_client, _peer, _err)
+#define SliceClientGetConnection(_client) slice_client_get_connection(_client)
 
 #endif
@@ -1,16 +1,28 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/errqueue.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "slice-connection.h"
 #include "slice-ssl-client.h"
 #include "slice-ssl-server.h"
 
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY    0x4000000
+#endif
+
 struct slice_connection_ip4_tcp
 {
     struct sockaddr_in peer_addr;
@@ -61,8 +73,57 @@ struct slice_connection
     SliceBuffer *read_buffer;
     SliceBuffer *write_buffer;
 
+    // segmented reads chain pool blocks behind read_buffer instead of growing it, read_buffer stays the oldest block
+    int read_segmented;
+    SliceBuffer *read_segments;
+
+    // scratch reads borrow the loop scratch as read_buffer for one callback, only leftovers get a buffer of our own
+    int read_scratch;
+    int read_scratch_lent;
+
     SliceSSLContext *ssl_ctx;
     void(*close_callback)(SliceConnection*, void*, char*);
+
+    // deadlines share one lazily re-armed timer, activity only moves the timestamps
+    SliceTimer deadline_timer;
+
+    unsigned int idle_timeout;
+    unsigned int handshake_timeout;
+    unsigned int write_timeout;
+    unsigned int read_buffer_timeout;
+
+    unsigned long long handshake_start;
+    unsigned long long last_activity;
+    unsigned long long last_write;
+    unsigned long long last_read;
+
+    unsigned int read_budget;       // bytes per read round before yielding, 0 reads until drained
+    unsigned int read_size_hint;    // recent read round size, new read buffers are sized from it
+
+    // MSG_ZEROCOPY sends, buffers stay pinned until the error queue reports their send done
+    unsigned int zerocopy_threshold;    // batch bytes to send zero-copy, 0 disables
+    unsigned int zerocopy_seq;          // next send number, counted the same way as the kernel
+    unsigned int zerocopy_done;         // sends below this are completed
+    SliceBuffer *zerocopy_buffer;
+
+    // pipe of the head entry watched for data while it is empty, the socket isn't what that write waits on
+    int write_source_watch;             // -1 when none
+    int write_source_empty;
+
+    // write queue backpressure, blocked once the queued bytes reach the high watermark until they drain to the low one
+    unsigned long long write_queued;
+    unsigned long long write_high_watermark;    // 0 disables
+    unsigned long long write_low_watermark;
+    int write_blocked;
+
+    void(*write_blocked_callback)(SliceConnection*, void*);
+    void(*write_drained_callback)(SliceConnection*, void*);
+
+    SliceConnection *write_peer;        // reads of this one pause while the queue is blocked, may be the connection itself
+    SliceConnection *write_peer_of;     // back link of the connection pausing our reads
+    int read_paused;
+
+    int completion;                     // reads and writes complete through io_uring requests, see slice_connection_set_completion
 };
 
 
@@ -70,7 +131,7 @@ SliceReturnType slice_connection_init(SliceConnection *conn, int fd, char *err)
 {
     int skflag;
 
-    if (!conn || fd < 0 || fd > 0xffff) {
+    if (!conn || fd < 0) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
@@ -122,14 +183,482 @@ SliceReturnType slice_connection_set_close_callback(SliceConnection *conn, void(
     return SLICE_RETURN_NORMAL;
 }
 
-SliceConnection *slice_connection_create(SliceMainloopEvent *mainloop_event, int fd, SliceConnectionMode mode, SliceConnectionType type, char *err)
+static int slice_connection_in_handshake(SliceConnection *conn)
+{
+    if (!conn->ssl_ctx) return 0;
+
+    if (conn->type == SLICE_CONNECTION_TYPE_CLIENT) {
+        return (SliceSSLClientGetState(conn->mainloop_event->io.fd) != SLICE_SSL_STATE_CONNECTED) ? 1 : 0;
+    }
+
+    return (SliceSSLSessionGetState(conn->mainloop_event->io.fd) != SLICE_SSL_STATE_CONNECTED) ? 1 : 0;
+}
+
+static void slice_connection_read_buffer_release(SliceConnection *conn)
+{
+    SliceBuffer *buffer;
+
+    // the loop scratch is never ours to release
+    if (conn->read_scratch_lent) {
+        conn->read_buffer = NULL;
+        conn->read_scratch_lent = 0;
+    }
+
+    if (conn->read_buffer) SliceBufferRelease(conn->mainloop_event->mainloop, &(conn->read_buffer), NULL);
+
+    while ((buffer = conn->read_segments)) {
+        SliceListRemove(&(conn->read_segments), buffer, NULL);
+        SliceBufferRelease(conn->mainloop_event->mainloop, &buffer, NULL);
+    }
+}
+
+// nearest absolute deadline, 0 when nothing is armed
+static unsigned long long slice_connection_next_deadline(SliceConnection *conn)
+{
+    unsigned long long next = 0, deadline;
+
+    if (conn->idle_timeout) {
+        next = conn->last_activity + conn->idle_timeout;
+    }
+
+    if (conn->read_buffer_timeout && conn->read_buffer) {
+        deadline = conn->last_read + conn->read_buffer_timeout;
+        if (!next || deadline < next) next = deadline;
+    }
+
+    if (conn->handshake_timeout && slice_connection_in_handshake(conn)) {
+        deadline = conn->handshake_start + conn->handshake_timeout;
+        if (!next || deadline < next) next = deadline;
+    }
+
+    if (conn->write_timeout && conn->write_buffer) {
+        deadline = conn->last_write + conn->write_timeout;
+        if (!next || deadline < next) next = deadline;
+    }
+
+    return next;
+}
+
+static void slice_connection_deadline_arm(SliceConnection *conn)
+{
+    unsigned long long next, now;
+
+    if (!conn->mainloop_event || !conn->mainloop_event->mainloop) return;
+
+    if (!(next = slice_connection_next_deadline(conn))) return;
+
+    // a pending timer that fires no later is enough, it re-checks on expiry
+    if (SliceTimerIsPending(&(conn->deadline_timer)) && conn->deadline_timer.expire <= next) return;
+
+    now = SliceTimerNow();
+
+    SliceMainloopTimerStart(conn->mainloop_event->mainloop, &(conn->deadline_timer), (next > now) ? (unsigned int)(next - now) : 0, 0, NULL);
+}
+
+static void slice_connection_deadline_callback(SliceTimer *timer, void *user_data)
+{
+    SliceConnection *conn = (SliceConnection*)user_data;
+    SliceMainloopEvent *mainloop_event;
+    unsigned long long now;
+    char *reason = NULL;
+
+    now = SliceTimerNow();
+
+    if (conn->read_buffer_timeout && conn->read_buffer && now >= conn->last_read + conn->read_buffer_timeout) {
+        if (slice_connection_get_read_length(conn) == 0) {
+            slice_connection_read_buffer_release(conn);
+        } else {
+            // a partial frame is still waiting, look again a period later
+            conn->last_read = now;
+        }
+    }
+
+    if (conn->handshake_timeout && slice_connection_in_handshake(conn) && now >= conn->handshake_start + conn->handshake_timeout) {
+        reason = "Handshake timeout";
+    } else if (conn->write_timeout && conn->write_buffer && now >= conn->last_write + conn->write_timeout) {
+        reason = "Write timeout";
+    } else if (conn->idle_timeout && now >= conn->last_activity + conn->idle_timeout) {
+        reason = "Idle timeout";
+    }
+
+    if (!reason) {
+        slice_connection_deadline_arm(conn);
+        return;
+    }
+
+    mainloop_event = conn->mainloop_event;
+
+    printf("Connection [%p] sock [%d] %s\n", conn, mainloop_event->io.fd, reason);
+
+    if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, reason);
+
+    // same teardown as a read error, the owner event also destroys this connection
+    SliceMainloopEventRemove(mainloop_event->mainloop, mainloop_event, NULL);
+    free(mainloop_event);
+}
+
+SliceReturnType slice_connection_set_timeout(SliceConnection *conn, SliceConnectionTimeout type, unsigned int timeout, char *err)
+{
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    switch (type) {
+        case SLICE_CONNECTION_TIMEOUT_IDLE:
+            conn->idle_timeout = timeout;
+            conn->last_activity = SliceTimerNow();
+            break;
+
+        case SLICE_CONNECTION_TIMEOUT_HANDSHAKE:
+            conn->handshake_timeout = timeout;
+            conn->handshake_start = SliceTimerNow();
+            break;
+
+        case SLICE_CONNECTION_TIMEOUT_WRITE:
+            conn->write_timeout = timeout;
+            conn->last_write = SliceTimerNow();
+            break;
+
+        case SLICE_CONNECTION_TIMEOUT_READ_BUFFER:
+            conn->read_buffer_timeout = timeout;
+            conn->last_read = SliceTimerNow();
+            break;
+
+        default:
+            if (err) sprintf(err, "Invalid timeout type [%d]", (int)type);
+            return SLICE_RETURN_ERROR;
+    }
+
+    slice_connection_deadline_arm(conn);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_connection_set_read_budget(SliceConnection *conn, unsigned int budget, char *err)
+{
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    conn->read_budget = budget;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// SO_BUSY_POLL, values over net.core.busy_read need CAP_NET_ADMIN
+SliceReturnType slice_connection_set_busy_poll(SliceConnection *conn, unsigned int usec, char *err)
+{
+#ifdef SO_BUSY_POLL
+    int value = (int)usec;
+
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (setsockopt(conn->mainloop_event->io.fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0) {
+        if (err) sprintf(err, "setsockopt(SO_BUSY_POLL) return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+#else
+    if (err) sprintf(err, "SO_BUSY_POLL is not supported");
+    return SLICE_RETURN_ERROR;
+#endif
+}
+
+// SO_ZEROCOPY, write batches of at least threshold bytes are sent with MSG_ZEROCOPY, 0 disables
+SliceReturnType slice_connection_set_zerocopy(SliceConnection *conn, unsigned int threshold, char *err)
+{
+#ifdef SO_ZEROCOPY
+    int value = (threshold) ? 1 : 0;
+
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (conn->ssl_ctx) {
+        if (err) sprintf(err, "Zero-copy send is not supported with SSL");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // the socket option stays on, pinned buffers are still reported after disabling
+    if (value && setsockopt(conn->mainloop_event->io.fd, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) != 0) {
+        if (err) sprintf(err, "setsockopt(SO_ZEROCOPY) return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+    conn->zerocopy_threshold = threshold;
+
+    return SLICE_RETURN_NORMAL;
+#else
+    if (err) sprintf(err, "MSG_ZEROCOPY is not supported");
+    return SLICE_RETURN_ERROR;
+#endif
+}
+
+// plain TCP on an io_uring loop reads and writes through completion requests, INFO when the connection stays on readiness
+SliceReturnType slice_connection_set_completion(SliceConnection *conn, char *err)
+{
+    SliceReturnType ret;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!conn || !conn->mainloop_event->mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // SSL reads and writes its records itself
+    if (conn->ssl_ctx || !(conn->mode & SLICE_CONNECTION_MODE_TCP)) return SLICE_RETURN_INFO;
+
+    if ((ret = SliceMainloopEpollEventSetCompletion(conn->mainloop_event->mainloop, conn->mainloop_event->io.fd, 0, err_buff)) == SLICE_RETURN_ERROR) {
+        if (err) sprintf(err, "SliceMainloopEpollEventSetCompletion return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (ret == SLICE_RETURN_NORMAL) conn->completion = 1;
+
+    return ret;
+}
+
+static void slice_connection_read_pause(SliceConnection *conn, int pause)
+{
+    SliceMainloopEvent *mainloop_event;
+
+    mainloop_event = (SliceMainloopEvent*)conn->mainloop_event;
+
+    if (conn->read_paused == pause || !mainloop_event->mainloop) return;
+
+    conn->read_paused = pause;
+
+    if (pause) {
+        SliceMainloopEpollEventRemoveRead(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+    } else {
+        // the edge may have passed while paused, and SSL can hold decrypted data, so try a read either way
+        SliceMainloopEpollEventAddRead(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+        SliceMainloopEpollEventReady(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+    }
+}
+
+static void slice_connection_write_queue_account(SliceConnection *conn, long long delta)
+{
+    if (delta < 0 && (unsigned long long)(-delta) > conn->write_queued) delta = -(long long)conn->write_queued;
+
+    conn->write_queued += delta;
+
+    if (conn->mainloop_event->mainloop) SliceMainloopAccountWriteQueue(conn->mainloop_event->mainloop, delta);
+}
+
+// callbacks run after the queue changed, they may write again but must not destroy the connection
+static void slice_connection_write_watermark_check(SliceConnection *conn)
+{
+    if (!conn->write_blocked) {
+        if (!conn->write_high_watermark || conn->write_queued < conn->write_high_watermark) return;
+
+        conn->write_blocked = 1;
+
+        if (conn->write_peer) slice_connection_read_pause(conn->write_peer, 1);
+        if (conn->write_blocked_callback) conn->write_blocked_callback(conn, conn->mainloop_event->user_data);
+    } else {
+        if (conn->write_high_watermark && conn->write_queued > conn->write_low_watermark) return;
+
+        conn->write_blocked = 0;
+
+        if (conn->write_peer) slice_connection_read_pause(conn->write_peer, 0);
+        if (conn->write_drained_callback) conn->write_drained_callback(conn, conn->mainloop_event->user_data);
+    }
+}
+
+// queued bytes at or over high block the connection until they drain to low, high 0 disables
+SliceReturnType slice_connection_set_write_watermark(SliceConnection *conn, unsigned long long high, unsigned long long low, char *err)
+{
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (high && low >= high) {
+        if (err) sprintf(err, "Low watermark [%llu] must be below high watermark [%llu]", low, high);
+        return SLICE_RETURN_ERROR;
+    }
+
+    conn->write_high_watermark = high;
+    conn->write_low_watermark = low;
+
+    slice_connection_write_watermark_check(conn);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_connection_set_write_callback(SliceConnection *conn, void(*write_blocked_callback)(SliceConnection*, void*), void(*write_drained_callback)(SliceConnection*, void*), char *err)
+{
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    conn->write_blocked_callback = write_blocked_callback;
+    conn->write_drained_callback = write_drained_callback;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// peer is where the queued data comes from, its reads pause while conn is blocked, NULL unlinks
+SliceReturnType slice_connection_set_write_peer(SliceConnection *conn, SliceConnection *peer, char *err)
+{
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (peer && peer->mainloop_event->mainloop != conn->mainloop_event->mainloop) {
+        if (err) sprintf(err, "Peer runs on another mainloop");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (peer && peer->write_peer_of && peer->write_peer_of != conn) {
+        if (err) sprintf(err, "Peer reads are already paused by another connection");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (conn->write_peer) {
+        if (conn->write_blocked) slice_connection_read_pause(conn->write_peer, 0);
+        conn->write_peer->write_peer_of = NULL;
+    }
+
+    if ((conn->write_peer = peer)) {
+        peer->write_peer_of = conn;
+        if (conn->write_blocked) slice_connection_read_pause(peer, 1);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+unsigned long long slice_connection_get_write_queued(SliceConnection *conn)
+{
+    if (!conn) return 0;
+
+    return conn->write_queued;
+}
+
+// file and pipe entries are sent from their descriptor, the others from memory
+static int slice_connection_write_entry_is_fd(SliceBuffer *buffer)
+{
+    return (buffer->source == SLICE_BUFFER_SOURCE_FILE || buffer->source == SLICE_BUFFER_SOURCE_PIPE) ? 1 : 0;
+}
+
+static char *slice_connection_write_entry_data(SliceBuffer *buffer)
+{
+    return (buffer->source == SLICE_BUFFER_SOURCE_SHARED) ? buffer->source_buffer->data : buffer->data;
+}
+
+// write queue entries own the descriptor of file and pipe sources and one reference of a shared buffer
+static void slice_connection_write_entry_release(SliceConnection *conn, SliceBuffer *buffer)
+{
+    if (slice_connection_write_entry_is_fd(buffer)) {
+        if (conn->write_source_watch == buffer->source_fd) {
+            SliceMainloopEpollEventUnwatch(conn->mainloop_event->mainloop, buffer->source_fd, NULL);
+            conn->write_source_watch = -1;
+            conn->write_source_empty = 0;
+        }
+
+        close(buffer->source_fd);
+    } else if (buffer->source == SLICE_BUFFER_SOURCE_SHARED) {
+        SliceBufferRelease(conn->mainloop_event->mainloop, &(buffer->source_buffer), NULL);
+    }
+
+    buffer->source = SLICE_BUFFER_SOURCE_DATA;
+
+    SliceBufferRelease(conn->mainloop_event->mainloop, &buffer, NULL);
+}
+
+// a zero-copy send not reported done may still be read from, its data never goes back to the pool
+static void slice_connection_write_entry_discard(SliceConnection *conn, SliceBuffer *buffer)
+{
+    if (!buffer->zerocopy_seq || (int)(buffer->zerocopy_seq - 1 - conn->zerocopy_done) < 0) {
+        slice_connection_write_entry_release(conn, buffer);
+        return;
+    }
+
+    if (buffer->source == SLICE_BUFFER_SOURCE_SHARED) {
+        SliceBufferDiscard(conn->mainloop_event->mainloop, &(buffer->source_buffer), NULL);
+        buffer->source = SLICE_BUFFER_SOURCE_DATA;
+        slice_connection_write_entry_release(conn, buffer);
+        return;
+    }
+
+    SliceBufferDiscard(conn->mainloop_event->mainloop, &buffer, NULL);
+}
+
+// pinned buffers leave in send order, stop at the first send not reported yet
+static void slice_connection_zerocopy_release(SliceConnection *conn)
+{
+    SliceBuffer *buffer;
+
+    while ((buffer = conn->zerocopy_buffer) && (int)(buffer->zerocopy_seq - 1 - conn->zerocopy_done) < 0) {
+        SliceListRemove(&(conn->zerocopy_buffer), buffer, NULL);
+        slice_connection_write_entry_release(conn, buffer);
+    }
+}
+
+// drain zero-copy completions from the error queue and release the buffers the kernel let go, returns the number of notifications
+int slice_connection_zerocopy_complete(SliceConnection *conn, char *err)
+{
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    char control[128];
+    int count = 0;
+
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return -1;
+    }
+
+    // completions may come before the buffer leaves the write queue, so drain whenever sends are outstanding
+    if (conn->zerocopy_seq == conn->zerocopy_done) return 0;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(conn->mainloop_event->io.fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (err) sprintf(err, "recvmsg(MSG_ERRQUEUE) return error [%s]", strerror(errno));
+            return -1;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) continue;
+
+            serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            // [ee_info, ee_data] finished, TCP reports ranges in order
+            if ((int)(serr->ee_data + 1 - conn->zerocopy_done) > 0) conn->zerocopy_done = serr->ee_data + 1;
+            count++;
+        }
+    }
+
+    slice_connection_zerocopy_release(conn);
+
+    return count;
+}
+
+// addr is the peer address accept already returned, NULL asks getpeername
+static SliceConnection *slice_connection_create_internal(SliceMainloopEvent *mainloop_event, int fd, struct sockaddr *addr, int nonblocking, SliceConnectionMode mode, SliceConnectionType type, char *err)
 {
     SliceConnection *conn;
     socklen_t addr_len;
 
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    if (!mainloop_event || fd < 0 || fd > 0xffff) {
+    if (!mainloop_event || fd < 0) {
         if (err) sprintf(err, "Invalid parameter");
         return NULL;
     }
@@ -144,33 +673,29 @@ SliceConnection *slice_connection_create(SliceMainloopEvent *mainloop_event, int
     if (mode == SLICE_CONNECTION_MODE_IP4_TCP) {
         addr_len = sizeof(conn->args.ip4_tcp.peer_addr);
 
-        if (getpeername(fd, (struct sockaddr*)&(conn->args.ip4_tcp.peer_addr), &addr_len) != 0) {
+        if (addr) {
+            memcpy(&(conn->args.ip4_tcp.peer_addr), addr, addr_len);
+        } else if (getpeername(fd, (struct sockaddr*)&(conn->args.ip4_tcp.peer_addr), &addr_len) != 0) {
             if (err) sprintf(err, "getpeername return error [%s]", strerror(errno));
             free(conn);
             return NULL;
         }
 
-        if (inet_ntop(AF_INET, &(conn->args.ip4_tcp.peer_addr.sin_addr), conn->args.ip4_tcp.peer_ip, sizeof(conn->args.ip4_tcp.peer_ip))) {
-            conn->args.ip4_tcp.peer_port = conn->args.ip4_tcp.peer_addr.sin_port;
-        } else {
-            conn->args.ip4_tcp.peer_ip[0] = 0;
-            conn->args.ip4_tcp.peer_port = 0;
-        }
+        // peer ip is formatted on first use
+        conn->args.ip4_tcp.peer_port = conn->args.ip4_tcp.peer_addr.sin_port;
     } else if (mode == SLICE_CONNECTION_MODE_IP6_TCP) {
         addr_len = sizeof(conn->args.ip6_tcp.peer_addr);
 
-        if (getpeername(fd, (struct sockaddr*)&(conn->args.ip6_tcp.peer_addr), &addr_len) != 0) {
+        if (addr) {
+            memcpy(&(conn->args.ip6_tcp.peer_addr), addr, addr_len);
+        } else if (getpeername(fd, (struct sockaddr*)&(conn->args.ip6_tcp.peer_addr), &addr_len) != 0) {
             if (err) sprintf(err, "getpeername return error [%s]", strerror(errno));
             free(conn);
             return NULL;
         }
 
-        if (inet_ntop(AF_INET6, &(conn->args.ip6_tcp.peer_addr.sin6_addr), conn->args.ip6_tcp.peer_ip, sizeof(conn->args.ip6_tcp.peer_ip))) {
-            conn->args.ip6_tcp.peer_port = conn->args.ip6_tcp.peer_addr.sin6_port;
-        } else {
-            conn->args.ip6_tcp.peer_ip[0] = 0;
-            conn->args.ip6_tcp.peer_port = 0;
-        }
+        // peer ip is formatted on first use
+        conn->args.ip6_tcp.peer_port = conn->args.ip6_tcp.peer_addr.sin6_port;
     } else if (mode == SLICE_CONNECTION_MODE_IP4_UDP) {
         if (err) sprintf(err, "Connection mode [%d] not implement yet", (int)mode);
         free(conn);
@@ -181,7 +706,8 @@ SliceConnection *slice_connection_create(SliceMainloopEvent *mainloop_event, int
         return NULL;
     }
 
-    if (slice_connection_init(conn, fd, err_buff) != SLICE_RETURN_NORMAL) {
+    // only the accept4 path of the server vouches for O_NONBLOCK, any other socket gets the fcntl
+    if (((nonblocking) ? SliceIOInit(conn, fd, err_buff) : slice_connection_init(conn, fd, err_buff)) != SLICE_RETURN_NORMAL) {
         if (err) sprintf(err, "Connection [%d] slice_connection_init return error [%s]", fd, err_buff);
         free(conn);
         return NULL;
@@ -192,28 +718,86 @@ SliceConnection *slice_connection_create(SliceMainloopEvent *mainloop_event, int
     conn->mode = mode;
     conn->type = type;
 
+    conn->read_budget = SLICE_CONNECTION_DEFAULT_READ_BUDGET;
+    conn->read_size_hint = DEFAULT_READ_BUFFER_SIZE;
+    conn->write_source_watch = -1;
+
+    SliceTimerInit(&(conn->deadline_timer), slice_connection_deadline_callback, conn, NULL);
+    conn->handshake_start = conn->last_activity = conn->last_write = SliceTimerNow();
+
     return conn;
 }
 
-SliceReturnType slice_connection_destroy(SliceConnection *conn, char *err)
+SliceConnection *slice_connection_create(SliceMainloopEvent *mainloop_event, int fd, SliceConnectionMode mode, SliceConnectionType type, char *err)
+{
+    return slice_connection_create_internal(mainloop_event, fd, NULL, 0, mode, type, err);
+}
+
+// for accepted sockets, addr saves the getpeername, nonblocking skips the fcntl for sockets from accept4 with SOCK_NONBLOCK
+SliceConnection *slice_connection_create_accepted(SliceMainloopEvent *mainloop_event, int fd, struct sockaddr *addr, int nonblocking, SliceConnectionMode mode, SliceConnectionType type, char *err)
+{
+    if (!addr) {
+        if (err) sprintf(err, "Invalid parameter");
+        return NULL;
+    }
+
+    return slice_connection_create_internal(mainloop_event, fd, addr, nonblocking, mode, type, err);
+}
+
+// hand back what belongs to the mainloop while the owner event is still attached, the socket stays open
+SliceReturnType slice_connection_detach(SliceConnection *conn, char *err)
 {
     SliceBuffer *buff;
-    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
     if (!conn) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    if (conn->read_buffer) {
-        SliceBufferRelease(conn->mainloop_event->mainloop, &(conn->read_buffer), NULL);
+    if (SliceTimerIsPending(&(conn->deadline_timer))) {
+        SliceTimerWheelStop(conn->deadline_timer.wheel, &(conn->deadline_timer), NULL);
     }
 
+    slice_connection_read_buffer_release(conn);
+
     while ((buff = conn->write_buffer)) {
         SliceListRemove(&(conn->write_buffer), buff, NULL);
-        SliceBufferRelease(conn->mainloop_event->mainloop, &buff, NULL);
+        slice_connection_write_entry_discard(conn, buff);
+    }
+
+    if (conn->write_queued) slice_connection_write_queue_account(conn, -(long long)conn->write_queued);
+
+    // a peer paused by this connection reads again, one pausing us forgets it
+    if (conn->write_peer && conn->write_peer != conn) {
+        if (conn->write_blocked) slice_connection_read_pause(conn->write_peer, 0);
+        conn->write_peer->write_peer_of = NULL;
+    }
+
+    if (conn->write_peer_of && conn->write_peer_of != conn) conn->write_peer_of->write_peer = NULL;
+
+    conn->write_peer = conn->write_peer_of = NULL;
+
+    // no completion comes once the socket is closed, pages the kernel still holds must not be handed out again
+    while ((buff = conn->zerocopy_buffer)) {
+        SliceListRemove(&(conn->zerocopy_buffer), buff, NULL);
+        slice_connection_write_entry_discard(conn, buff);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_connection_destroy(SliceConnection *conn, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
     }
 
+    // nothing left once the owner detached it, otherwise the event is still attached
+    slice_connection_detach(conn, NULL);
+
     if (conn->ssl_ctx) {
         // check client or session
         if (conn->type == SLICE_CONNECTION_TYPE_CLIENT) {
@@ -237,13 +821,25 @@ SliceReturnType slice_connection_destroy(SliceConnection *conn, char *err)
     return SLICE_RETURN_NORMAL;
 }
 
+// unread bytes live in [current, length), consumed bytes are only dropped once the tail runs short
+static void slice_connection_read_buffer_compact(SliceBuffer *buffer)
+{
+    if (buffer->current == 0) return;
+
+    memmove(buffer->data, buffer->data + buffer->current, buffer->length - buffer->current);
+
+    buffer->length -= buffer->current;
+    buffer->current = 0;
+    buffer->data[buffer->length] = 0;
+}
+
 // for event read callback
 SliceReturnType slice_connection_socket_read(SliceConnection *conn, int *read_length, char *err)
 {
     SliceMainloopEvent *mainloop_event;
     SliceBuffer *buffer = NULL;
     int r, ret, err_num = 0;
-    unsigned int n;
+    unsigned int n, size;
 
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
@@ -251,7 +847,13 @@ SliceReturnType slice_connection_socket_read(SliceConnection *conn, int *read_le
 
     *read_length = 0;
 
-    if ((conn->mode & SLICE_CONNECTION_MODE_TCP) && conn->ssl_ctx) {
+    if (!(conn->mode & SLICE_CONNECTION_MODE_TCP)) {
+        if (err) sprintf(err, "UDP not implement yet");
+        if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, "UDP is not implmented");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (conn->ssl_ctx) {
         if (conn->type == SLICE_CONNECTION_TYPE_CLIENT && SliceSSLClientGetState(mainloop_event->io.fd) != SLICE_SSL_STATE_CONNECTED) {
             if ((r = SliceSSLClientConnect(mainloop_event->io.fd, conn->ssl_ctx, err_buff)) == SLICE_RETURN_INFO) {
                 return SLICE_RETURN_INFO;
@@ -279,101 +881,366 @@ SliceReturnType slice_connection_socket_read(SliceConnection *conn, int *read_le
         if (conn->write_buffer) SliceMainloopEpollEventAddWrite(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
     }
 
+    size = (conn->read_size_hint > MIN_READ_BUFFER_SIZE) ? conn->read_size_hint : MIN_READ_BUFFER_SIZE;
+
+    // nothing left over, read into the loop scratch and drop the buffer of our own
+    if (conn->read_scratch && !conn->read_scratch_lent && (!(buffer = conn->read_buffer) || (buffer->length == 0 && !conn->read_segments))) {
+        if ((buffer = SliceMainloopGetReadScratch(mainloop_event->mainloop, NULL))) {
+            if (conn->read_buffer) SliceBufferRelease(mainloop_event->mainloop, &(conn->read_buffer), NULL);
+
+            buffer->length = 0;
+            buffer->current = 0;
+
+            conn->read_buffer = buffer;
+            conn->read_scratch_lent = 1;
+        }
+    }
+
+    // reads got smaller, an empty buffer is traded for a class that fits them
+    if ((buffer = conn->read_buffer) && !conn->read_scratch_lent && buffer->length == 0 && !conn->read_segments && buffer->size / 4 >= size) {
+        SliceBufferRelease(mainloop_event->mainloop, &(conn->read_buffer), NULL);
+    }
+
     if (!(buffer = conn->read_buffer)) {
-        if (!(conn->read_buffer = buffer = SliceBufferCreate(mainloop_event->mainloop, DEFAULT_READ_BUFFER_SIZE, err_buff))) {
+        if (!(conn->read_buffer = buffer = SliceBufferCreate(mainloop_event->mainloop, size, err_buff))) {
             if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
             if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
             return SLICE_RETURN_ERROR;
         }
     }
 
-#define SLICE_SSL_READ_SPEED_HACK
-#ifdef SLICE_SSL_READ_SPEED_HACK
-#define SLICE_SSL_READ_SPEED_HACK_MAX_RETRY     10
-    int ssl_retry_count = 0;
-ssl_retry_read:
-#endif
-    n = buffer->size - buffer->length;
+    // segmented reads land in the newest block
+    if (conn->read_segments) buffer = (SliceBuffer*)conn->read_segments->obj.prev;
 
-    if (n < MIN_READ_BUFFER_SIZE) {
-        if (SliceBufferPrepare(mainloop_event->mainloop, &(conn->read_buffer), MIN_READ_BUFFER_SIZE, err_buff) != SLICE_RETURN_NORMAL) {
-            if (err) sprintf(err, "SliceBufferPrepare return error [%s]", err_buff);
-            if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
-            return SLICE_RETURN_ERROR;
+    // read until the socket is drained or the budget is spent, leftovers are resumed from the ready queue
+    for (;;) {
+        n = buffer->size - buffer->length;
+
+        if (n < MIN_READ_BUFFER_SIZE && conn->read_scratch_lent) {
+            // scratch is full, the rest is read once the callback took this part
+            SliceMainloopEpollEventReady(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+            break;
         }
 
-        buffer = conn->read_buffer;
-        n = buffer->size - buffer->length;
-    }
+        if (n < MIN_READ_BUFFER_SIZE && buffer->current > 0) {
+            slice_connection_read_buffer_compact(buffer);
+            n = buffer->size - buffer->length;
+        }
+
+        if (n < MIN_READ_BUFFER_SIZE && conn->read_segmented) {
+            // chain another block, what was read stays where it is
+            if (!(buffer = SliceBufferCreate(mainloop_event->mainloop, SLICE_CONNECTION_READ_SEGMENT_SIZE, err_buff))) {
+                if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
+                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
+                return SLICE_RETURN_ERROR;
+            }
+
+            SliceListAppend(&(conn->read_segments), buffer, NULL);
+            n = buffer->size - buffer->length;
+        } else if (n < MIN_READ_BUFFER_SIZE) {
+            if (SliceBufferPrepare(mainloop_event->mainloop, &(conn->read_buffer), MIN_READ_BUFFER_SIZE, err_buff) != SLICE_RETURN_NORMAL) {
+                if (err) sprintf(err, "SliceBufferPrepare return error [%s]", err_buff);
+                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
+                return SLICE_RETURN_ERROR;
+            }
+
+            buffer = conn->read_buffer;
+            n = buffer->size - buffer->length;
+        }
 
-    if (conn->mode & SLICE_CONNECTION_MODE_TCP) {
         if (conn->ssl_ctx) {
             if (conn->type == SLICE_CONNECTION_TYPE_CLIENT) {
-                if ((ret = SliceSSLClientRead(mainloop_event->io.fd, buffer->data + buffer->length, n, &r, &err_num, err_buff)) == SLICE_RETURN_ERROR) {
-#ifdef SLICE_SSL_READ_SPEED_HACK
-                    if (*read_length > 0) return SLICE_RETURN_NORMAL;
-#endif
-                    if (err_num == 0) {
-                        if (err) sprintf(err, "SliceSSLClientRead return error [%s]", err_buff);
-                    } else {
-                        if (err) sprintf(err, "SliceSSLClientRead system call [%s]", err_buff);
-                    }
+                ret = SliceSSLClientRead(mainloop_event->io.fd, buffer->data + buffer->length, n, &r, &err_num, err_buff);
+            } else {
+                ret = SliceSSLSessionRead(mainloop_event->io.fd, buffer->data + buffer->length, n, &r, &err_num, err_buff);
+            }
 
-                    if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
+            if (ret == SLICE_RETURN_INFO) break;
 
-                    return SLICE_RETURN_ERROR;
+            if (ret == SLICE_RETURN_ERROR) {
+                // deliver what was read first, the error comes back on the next round
+                if (*read_length > 0) {
+                    SliceMainloopEpollEventReady(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+                    break;
                 }
-            } else {
-                if ((ret = SliceSSLSessionRead(mainloop_event->io.fd, buffer->data + buffer->length, n, &r, &err_num, err_buff)) == SLICE_RETURN_ERROR) {
-#ifdef SLICE_SSL_READ_SPEED_HACK
-                    if (*read_length > 0) return SLICE_RETURN_NORMAL;
-#endif
-                    if (err_num == 0) {
-                        if (err) sprintf(err, "SliceSSLSessionRead return error [%s]", err_buff);
-                    } else {
-                        if (err) sprintf(err, "SliceSSLSessionRead system call [%s]", err_buff);
-                    }
 
-                    if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
+                if (err_num == 0) {
+                    if (err) sprintf(err, "%s return error [%s]", (conn->type == SLICE_CONNECTION_TYPE_CLIENT) ? "SliceSSLClientRead" : "SliceSSLSessionRead", err_buff);
+                } else {
+                    if (err) sprintf(err, "%s system call [%s]", (conn->type == SLICE_CONNECTION_TYPE_CLIENT) ? "SliceSSLClientRead" : "SliceSSLSessionRead", err_buff);
+                }
+
+                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
+
+                return SLICE_RETURN_ERROR;
+            }
+        } else {
+            r = (conn->completion) ? SliceMainloopEpollEventRecv(mainloop_event->mainloop, mainloop_event->io.fd, buffer->data + buffer->length, n) : recv(mainloop_event->io.fd, buffer->data + buffer->length, n, 0);
+
+            if (r <= 0) {
+                if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    // no data in socket buffer
+                    break;
+                }
+
+                if (*read_length > 0) {
+                    SliceMainloopEpollEventReady(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+                    break;
+                }
+
+                if (r < 0) {
+                    if (err) sprintf(err, "recv return error [%s]", strerror(errno));
+                } else {
+                    if (err) sprintf(err, "recv return connection closed");
+                }
+                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, strerror(errno));
+                return SLICE_RETURN_ERROR;
+            }
+        }
+
+        buffer->length += r;
+        buffer->data[buffer->length] = 0;
+
+        *read_length += r;
+
+        if (conn->read_budget && (unsigned int)*read_length >= conn->read_budget) {
+            // budget spent, let the other connections run first
+            SliceMainloopEpollEventReady(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+            break;
+        }
+
+        // a short plain read drained the socket, the next edge reports new data
+        if (!conn->ssl_ctx && (unsigned int)r < n) break;
+    }
+
+    if (*read_length == 0) return SLICE_RETURN_INFO;
+
+    // rises at once, decays by an eighth per round, one segment is the most a fresh buffer starts with
+    size = (unsigned int)*read_length;
+    if (size > SLICE_CONNECTION_READ_SEGMENT_SIZE) size = SLICE_CONNECTION_READ_SEGMENT_SIZE;
+    conn->read_size_hint = (size > conn->read_size_hint) ? size : conn->read_size_hint - (conn->read_size_hint - size) / 8;
+
+    if (conn->idle_timeout) conn->last_activity = SliceTimerNow();
+
+    if (conn->read_buffer_timeout) {
+        conn->last_read = SliceTimerNow();
+        slice_connection_deadline_arm(conn);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// end of a read round, the scratch goes back whatever the callback returned, a failure is reported like the rest of the read path
+SliceReturnType slice_connection_socket_read_done(SliceConnection *conn, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (slice_connection_release_read_scratch(conn, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "slice_connection_release_read_scratch return error [%s]", err_buff);
+        if (conn->close_callback) conn->close_callback(conn, conn->mainloop_event->user_data, err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// file ranges go straight from the page cache with sendfile, pipes are spliced, INFO when the socket is full or the pipe empty
+static SliceReturnType slice_connection_socket_write_source(SliceConnection *conn, SliceBuffer *buffer, char *err)
+{
+    SliceMainloopEvent *mainloop_event;
+    off_t offset;
+    ssize_t r;
+    size_t n;
+    int avail, pipe_ready = 0;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    mainloop_event = (SliceMainloopEvent*)conn->mainloop_event;
+
+    while (buffer->current < buffer->length) {
+        // bytes staged by a completion send go out first, its completion runs the write again
+        if (conn->completion && SliceMainloopEpollEventSendBusy(mainloop_event->mainloop, mainloop_event->io.fd)) return SLICE_RETURN_INFO;
+
+        n = buffer->length - buffer->current;
+
+        if (buffer->source == SLICE_BUFFER_SOURCE_FILE) {
+            offset = (off_t)(buffer->source_offset + buffer->current);
+            r = sendfile(mainloop_event->io.fd, buffer->source_fd, &offset, n);
+        } else {
+            r = splice(buffer->source_fd, NULL, mainloop_event->io.fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (buffer->source == SLICE_BUFFER_SOURCE_FILE) return SLICE_RETURN_INFO;
+
+            // socket full, pipe writes mean nothing until EPOLLOUT
+            if (pipe_ready) {
+                if (conn->write_source_empty) SliceMainloopEpollEventRemoveRead(mainloop_event->mainloop, buffer->source_fd, NULL);
+                conn->write_source_empty = 0;
+                return SLICE_RETURN_INFO;
+            }
+
+            // splice can't tell an empty pipe from a full socket, only we drain the pipe so data seen here was there for the retry
+            if (ioctl(buffer->source_fd, FIONREAD, &avail) < 0) {
+                if (err) sprintf(err, "ioctl FIONREAD return error [%s]", strerror(errno));
+                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, strerror(errno));
+                return SLICE_RETURN_ERROR;
+            }
+
+            if (avail > 0) {
+                pipe_ready = 1;
+                continue;
+            }
+
+            // waiting for the writer, the socket is not what this entry waits on
+            if (SliceMainloopEpollEventWatch(mainloop_event->mainloop, mainloop_event->io.fd, buffer->source_fd, err_buff) != SLICE_RETURN_NORMAL) {
+                if (err) sprintf(err, "SliceMainloopEpollEventWatch return error [%s]", err_buff);
+                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, err_buff);
+                return SLICE_RETURN_ERROR;
+            }
+
+            conn->write_source_watch = buffer->source_fd;
+            conn->write_source_empty = 1;
+
+            SliceMainloopEpollEventRemoveWrite(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
+
+            return SLICE_RETURN_INFO;
+        }
+
+        if (r < 0) {
+            if (err) sprintf(err, "%s return error [%s]", (buffer->source == SLICE_BUFFER_SOURCE_FILE) ? "sendfile" : "splice", strerror(errno));
+            if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+
+        if (r == 0) {
+            if (err) sprintf(err, "Source fd [%d] ended [%u] bytes short", buffer->source_fd, buffer->length - buffer->current);
+            if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, "write source ended early");
+            return SLICE_RETURN_ERROR;
+        }
+
+        buffer->current += (unsigned int)r;
+        slice_connection_write_queue_account(conn, -(long long)r);
+        pipe_ready = 0;
+
+        if (conn->idle_timeout || conn->write_timeout) conn->last_activity = conn->last_write = SliceTimerNow();
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// plain TCP flush, queued buffers go out in one sendmsg per SLICE_CONNECTION_WRITE_IOV_MAX
+static SliceReturnType slice_connection_socket_write_gather(SliceConnection *conn, char *err)
+{
+    SliceMainloopEvent *mainloop_event;
+    SliceBuffer *buffer;
+    SliceReturnType ret;
+    struct iovec iov[SLICE_CONNECTION_WRITE_IOV_MAX];
+    struct msghdr msg;
+    size_t total, left;
+    ssize_t r;
+    unsigned int n, seq = 0;
+    int count, zerocopy;
+
+    mainloop_event = (SliceMainloopEvent*)conn->mainloop_event;
+
+    while (conn->write_buffer) {
+        total = 0;
+        count = 0;
+
+        // file and pipe entries go out on their own, in queue order
+        if (slice_connection_write_entry_is_fd(buffer = conn->write_buffer)) {
+            if ((ret = slice_connection_socket_write_source(conn, buffer, err)) == SLICE_RETURN_ERROR) return SLICE_RETURN_ERROR;
+            if (ret == SLICE_RETURN_INFO) break;
+
+            SliceListRemove(&(conn->write_buffer), buffer, NULL);
+            slice_connection_write_entry_release(conn, buffer);
+            continue;
+        }
+
+        // the write queue is circular, stop when it wraps to the head or reaches a file entry
+        do {
+            if (slice_connection_write_entry_is_fd(buffer)) break;
+
+            if ((n = buffer->length - buffer->current) > 0) {
+                iov[count].iov_base = slice_connection_write_entry_data(buffer) + buffer->current;
+                iov[count].iov_len = n;
+                total += n;
+                count++;
+            }
+
+            buffer = (SliceBuffer*)buffer->obj.next;
+        } while (buffer != conn->write_buffer && count < SLICE_CONNECTION_WRITE_IOV_MAX);
+
+        r = 0;
+        // completion sends copy into the loop's staging buffer, nothing to pin
+        zerocopy = (conn->zerocopy_threshold && total >= conn->zerocopy_threshold && !conn->completion) ? 1 : 0;
+
+        if (count > 0) {
+            memset(&msg, 0, sizeof(struct msghdr));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+
+            // ENOBUFS is the optmem limit on pinned pages, that batch is copied instead
+            if (zerocopy && (r = sendmsg(mainloop_event->io.fd, &msg, MSG_ZEROCOPY)) < 0 && errno == ENOBUFS) zerocopy = 0;
+
+            if (!zerocopy) r = (conn->completion) ? SliceMainloopEpollEventSendmsg(mainloop_event->mainloop, mainloop_event->io.fd, &msg, 0) : sendmsg(mainloop_event->io.fd, &msg, 0);
+
+            if (r < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // socket send buffer full
+                    break;
+                }
+                if (err) sprintf(err, "sendmsg return error [%s]", strerror(errno));
+                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, strerror(errno));
+                return SLICE_RETURN_ERROR;
+            }
+
+            if (r > 0) slice_connection_write_queue_account(conn, -(long long)r);
+            if (r > 0 && (conn->idle_timeout || conn->write_timeout)) conn->last_activity = conn->last_write = SliceTimerNow();
+
+            // every zero-copy send that returns data gets the next completion number
+            if (r > 0 && zerocopy) seq = conn->zerocopy_seq++;
+        }
+
+        // advance across the sent buffers, empty ones are dropped on the way
+        left = (size_t)r;
+
+        while ((buffer = conn->write_buffer) && !slice_connection_write_entry_is_fd(buffer)) {
+            n = buffer->length - buffer->current;
+
+            if (zerocopy && r > 0 && left > 0) buffer->zerocopy_seq = seq + 1;
 
-                    return SLICE_RETURN_ERROR;
-                }
+            if (n > left) {
+                buffer->current += (unsigned int)left;
+                break;
             }
 
-            if (ret == SLICE_RETURN_INFO) {
-#ifdef SLICE_SSL_READ_SPEED_HACK
-                if (*read_length > 0) return SLICE_RETURN_NORMAL;
-#endif
-                return SLICE_RETURN_INFO;
-            }
-        } else {
-            if ((r = recv(mainloop_event->io.fd, buffer->data + buffer->length, n, 0)) < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    // no data in socket buffer
-                    //printf("recv wait next read\n");
-                    return SLICE_RETURN_INFO;
-                }
-                if (err) sprintf(err, "recv return error [%s]", strerror(errno));
-                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, strerror(errno));
-                return SLICE_RETURN_ERROR;
-            } else if (r == 0) {
-                if (err) sprintf(err, "recv return connection closed");
-                if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, strerror(errno));
-                return SLICE_RETURN_ERROR;
+            left -= n;
+            SliceListRemove(&(conn->write_buffer), buffer, NULL);
+
+            // the kernel still reads pinned data, released by slice_connection_zerocopy_complete
+            if (buffer->zerocopy_seq) {
+                SliceListAppend(&(conn->zerocopy_buffer), buffer, NULL);
+            } else {
+                slice_connection_write_entry_release(conn, buffer);
             }
         }
 
-        buffer->length += r;
-        buffer->data[buffer->length] = 0;
+        // short write, the rest waits for EPOLLOUT
+        if ((size_t)r < total) break;
+    }
 
-        *read_length += r;
-#ifdef SLICE_SSL_READ_SPEED_HACK
-        if (conn->ssl_ctx && (ssl_retry_count++) < SLICE_SSL_READ_SPEED_HACK_MAX_RETRY) goto ssl_retry_read;
-#endif
-    } else {
-        if (err) sprintf(err, "UDP not implement yet");
-        if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, "UDP is not implmented");
-        return SLICE_RETURN_ERROR;
+    // completions drained while the buffers were still queued
+    if (conn->zerocopy_buffer) slice_connection_zerocopy_release(conn);
+
+    // an entry waiting on its pipe is woken by the watch instead
+    if (conn->write_buffer && !conn->write_source_empty) {
+        SliceMainloopEpollEventAddWrite(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
     }
 
     return SLICE_RETURN_NORMAL;
@@ -403,9 +1270,21 @@ SliceReturnType slice_connection_socket_write(SliceConnection *conn, char *err)
 
             if (SliceSSLClientGetState(mainloop_event->io.fd) != SLICE_SSL_STATE_CONNECTED) return SLICE_RETURN_INFO;
         }
+
+        if (!conn->ssl_ctx) {
+            if ((ret = slice_connection_socket_write_gather(conn, err)) == SLICE_RETURN_NORMAL) slice_connection_write_watermark_check(conn);
+            return ret;
+        }
     }
 
+    // SSL records are written one buffer at a time
     while ((buffer = conn->write_buffer)) {
+        if (slice_connection_write_entry_is_fd(buffer)) {
+            if (err) sprintf(err, "File entries need a plain TCP connection");
+            if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, "file entry on SSL connection");
+            return SLICE_RETURN_ERROR;
+        }
+
         n = buffer->length - buffer->current;
 
         //printf("Trying write [%d][%.*s]\n", buffer->length, buffer->length, buffer->data);
@@ -416,7 +1295,7 @@ SliceReturnType slice_connection_socket_write(SliceConnection *conn, char *err)
             if (conn->mode & SLICE_CONNECTION_MODE_TCP) {
                 if (conn->ssl_ctx) {
                     if (conn->type == SLICE_CONNECTION_TYPE_CLIENT) {
-                        if ((ret = SliceSSLClientWrite(mainloop_event->io.fd, buffer->data + buffer->current, n, &r, &err_num, err_buff)) == SLICE_RETURN_ERROR) {
+                        if ((ret = SliceSSLClientWrite(mainloop_event->io.fd, slice_connection_write_entry_data(buffer) + buffer->current, n, &r, &err_num, err_buff)) == SLICE_RETURN_ERROR) {
                             if (err_num == 0) {
                                 if (err) sprintf(err, "SliceSSLClientWrite return error [%s]", err_buff);
                             } else {
@@ -428,7 +1307,7 @@ SliceReturnType slice_connection_socket_write(SliceConnection *conn, char *err)
                             return SLICE_RETURN_ERROR;
                         }
                     } else {
-                        if ((ret = SliceSSLSessionWrite(mainloop_event->io.fd, buffer->data + buffer->current, n, &r, &err_num, err_buff)) == SLICE_RETURN_ERROR) {
+                        if ((ret = SliceSSLSessionWrite(mainloop_event->io.fd, slice_connection_write_entry_data(buffer) + buffer->current, n, &r, &err_num, err_buff)) == SLICE_RETURN_ERROR) {
                             if (err_num == 0) {
                                 if (err) sprintf(err, "SliceSSLSessionWrite return error [%s]", err_buff);
                             } else {
@@ -445,17 +1324,6 @@ SliceReturnType slice_connection_socket_write(SliceConnection *conn, char *err)
                         printf("SSL_XXX_write return need re-write again\n");
                         break;
                     }
-                } else {
-                    if ((r = send(mainloop_event->io.fd, buffer->data + buffer->current, n, 0)) < 0) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            // socket send buffer full
-                            printf("socket send buffer full\n");
-                            break;
-                        }
-                        if (err) sprintf(err, "send return error [%s]", strerror(errno));
-                        if (conn->close_callback) conn->close_callback(conn, mainloop_event->user_data, strerror(errno));
-                        return SLICE_RETURN_ERROR;
-                    }
                 }
             } else {
                 if (err) sprintf(err, "UDP not implement yet");
@@ -469,21 +1337,26 @@ SliceReturnType slice_connection_socket_write(SliceConnection *conn, char *err)
             }
 
             buffer->current += r;
+            slice_connection_write_queue_account(conn, -(long long)r);
+
+            if (conn->idle_timeout || conn->write_timeout) conn->last_activity = conn->last_write = SliceTimerNow();
 
             if (buffer->current >= buffer->length) {
                 SliceListRemove(&(conn->write_buffer), buffer, NULL);
-                SliceBufferRelease(mainloop_event->mainloop, &buffer, NULL);
+                slice_connection_write_entry_release(conn, buffer);
             } else {
                 break;
             }
         } else {
-            SliceListRemove(conn->write_buffer, buffer, NULL);
-            SliceBufferRelease(mainloop_event->mainloop, &buffer, NULL);
+            SliceListRemove(&(conn->write_buffer), buffer, NULL);
+            slice_connection_write_entry_release(conn, buffer);
         }
     }
 
     if (conn->write_buffer) SliceMainloopEpollEventAddWrite(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
 
+    slice_connection_write_watermark_check(conn);
+
     return SLICE_RETURN_NORMAL;
 }
 
@@ -491,11 +1364,22 @@ SliceReturnType slice_connection_set_read_buffer_size(SliceConnection *conn, uns
 {
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    if (!conn || size > 0x8FFF) {
+    if (!conn) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
+    if (size > SLICE_CONNECTION_MAX_READ_BUFFER_SIZE) {
+        if (err) sprintf(err, "Read buffer size [%u] is over [%u], use segmented reads", size, SLICE_CONNECTION_MAX_READ_BUFFER_SIZE);
+        return SLICE_RETURN_ERROR;
+    }
+
+    // sizing applies to a buffer of our own, never to the loop scratch
+    if (slice_connection_release_read_scratch(conn, err) != SLICE_RETURN_NORMAL) return SLICE_RETURN_ERROR;
+
+    // segmented reads grow by chaining blocks
+    if (conn->read_segmented) return SLICE_RETURN_NORMAL;
+
     if (!conn->read_buffer) {
         if (!(conn->read_buffer = SliceBufferCreate(conn->mainloop_event->mainloop, size, err_buff))) {
             if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
@@ -517,11 +1401,20 @@ SliceReturnType slice_connection_need_read_buffer_size(SliceConnection *conn, un
 {
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    if (!conn || (conn->read_buffer->length + need_size) > 0x8FFF) {
+    if (!conn) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
+    if (conn->read_segmented) return SLICE_RETURN_NORMAL;
+
+    if (slice_connection_release_read_scratch(conn, err) != SLICE_RETURN_NORMAL) return SLICE_RETURN_ERROR;
+
+    if (need_size > SLICE_CONNECTION_MAX_READ_BUFFER_SIZE - ((conn->read_buffer) ? conn->read_buffer->length - conn->read_buffer->current : 0)) {
+        if (err) sprintf(err, "Read buffer need size [%u] is over [%u], use segmented reads", need_size, SLICE_CONNECTION_MAX_READ_BUFFER_SIZE);
+        return SLICE_RETURN_ERROR;
+    }
+
     if (!conn->read_buffer) {
         if (!(conn->read_buffer = SliceBufferCreate(conn->mainloop_event->mainloop, need_size, err_buff))) {
             if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
@@ -529,6 +1422,8 @@ SliceReturnType slice_connection_need_read_buffer_size(SliceConnection *conn, un
         }
     }
 
+    if ((conn->read_buffer->length + need_size) > conn->read_buffer->size) slice_connection_read_buffer_compact(conn->read_buffer);
+
     if ((conn->read_buffer->length + need_size) > conn->read_buffer->size) {
         if (SliceBufferPrepare(conn->mainloop_event->mainloop, &(conn->read_buffer), need_size + MIN_READ_BUFFER_SIZE, err_buff) != SLICE_RETURN_NORMAL) {
             if (err) sprintf(err, "SliceBufferPrepare return error [%s]", err_buff);
@@ -539,33 +1434,232 @@ SliceReturnType slice_connection_need_read_buffer_size(SliceConnection *conn, un
     return SLICE_RETURN_NORMAL;
 }
 
+// copies across segments, up to INT_MAX bytes per call
 int slice_connection_fetch_read_buffer(SliceConnection *conn, char *out, unsigned int out_size, char *err)
 {
     SliceBuffer *buffer;
-    unsigned int read_length;
+    unsigned int read_length = 0, n;
 
-    if (!conn || !out || out_size == 0 || out_size > 0x8FFF) {
+    if (!conn || !out || out_size == 0) {
         if (err) sprintf(err, "Invalid parameter");
         return -1;
     }
 
-    if (!(buffer = conn->read_buffer)) return 0;
+    if (out_size > INT_MAX) out_size = INT_MAX;
+
+    while (read_length < out_size && (buffer = conn->read_buffer) && buffer->current < buffer->length) {
+        n = buffer->length - buffer->current;
+        if (n > out_size - read_length) n = out_size - read_length;
 
-    read_length = (out_size < buffer->length) ? out_size : buffer->length;
+        memcpy(out + read_length, buffer->data + buffer->current, n);
+        slice_connection_consume_read_buffer(conn, n, NULL);
 
-    if (read_length > 0) {
-        memcpy(out, buffer->data, read_length);
-        if (read_length < buffer->length) {
-            memmove(buffer->data, buffer->data + read_length, buffer->length - read_length);
-            buffer->length -= read_length;
-            buffer->data[buffer->length] = 0;
-        } else {
+        read_length += n;
+    }
+
+    return (int)read_length;
+}
+
+// unread data in place, valid until the next read callback or consume, only the oldest block in segmented mode
+SliceReturnType slice_connection_peek_read_buffer(SliceConnection *conn, char **data, unsigned int *length, char *err)
+{
+    SliceBuffer *buffer;
+
+    if (!conn || !data || !length) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(buffer = conn->read_buffer) || buffer->current >= buffer->length) {
+        *data = NULL;
+        *length = 0;
+        return SLICE_RETURN_NORMAL;
+    }
+
+    *data = buffer->data + buffer->current;
+    *length = buffer->length - buffer->current;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_connection_consume_read_buffer(SliceConnection *conn, unsigned int length, char *err)
+{
+    SliceBuffer *buffer;
+    unsigned int n;
+
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(buffer = conn->read_buffer)) {
+        if (length == 0) return SLICE_RETURN_NORMAL;
+        if (err) sprintf(err, "Read buffer is empty");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (length > buffer->length - buffer->current && length > slice_connection_get_read_length(conn)) {
+        if (err) sprintf(err, "Consume length [%u] is over unread length [%llu]", length, slice_connection_get_read_length(conn));
+        return SLICE_RETURN_ERROR;
+    }
+
+    for (;;) {
+        n = buffer->length - buffer->current;
+        if (n > length) n = length;
+
+        buffer->current += n;
+        length -= n;
+
+        if (buffer->current < buffer->length) break;
+
+        if (!conn->read_segments) {
+            // fully drained buffers rewind for free
+            buffer->current = 0;
             buffer->length = 0;
+            buffer->data[0] = 0;
+            break;
         }
-        buffer->current = 0;
+
+        // the oldest block is done, the next one takes its place
+        SliceBufferRelease(conn->mainloop_event->mainloop, &(conn->read_buffer), NULL);
+
+        buffer = conn->read_buffer = conn->read_segments;
+        SliceListRemove(&(conn->read_segments), buffer, NULL);
+
+        if (length == 0 && buffer->current < buffer->length) break;
     }
-    
-    return (int)read_length;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// chained reads for frames larger than one buffer should hold, only switched off once at most one block is left
+SliceReturnType slice_connection_set_read_segmented(SliceConnection *conn, int enable, char *err)
+{
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!enable && conn->read_segments) {
+        if (err) sprintf(err, "Read data spans several segments, consume it first");
+        return SLICE_RETURN_ERROR;
+    }
+
+    conn->read_segmented = (enable) ? 1 : 0;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// reads borrow the loop scratch while nothing is left over, which keeps idle connections without a read buffer
+SliceReturnType slice_connection_set_read_scratch(SliceConnection *conn, int enable, char *err)
+{
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!enable && slice_connection_release_read_scratch(conn, err) != SLICE_RETURN_NORMAL) return SLICE_RETURN_ERROR;
+
+    conn->read_scratch = (enable) ? 1 : 0;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// hand the loop scratch back after the read callback, unread bytes move to a buffer of our own
+SliceReturnType slice_connection_release_read_scratch(SliceConnection *conn, char *err)
+{
+    SliceBuffer *scratch, *buffer;
+    unsigned int length;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!conn) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!conn->read_scratch_lent) return SLICE_RETURN_NORMAL;
+
+    scratch = conn->read_buffer;
+    length = scratch->length - scratch->current;
+
+    conn->read_buffer = NULL;
+    conn->read_scratch_lent = 0;
+
+    if (length > 0) {
+        // room for the rest of the frame, the next read goes on from here
+        if (!(buffer = SliceBufferCreate(conn->mainloop_event->mainloop, length + MIN_READ_BUFFER_SIZE, err_buff))) {
+            if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
+            scratch->length = scratch->current = 0;
+            return SLICE_RETURN_ERROR;
+        }
+
+        memcpy(buffer->data, scratch->data + scratch->current, length);
+        buffer->length = length;
+        buffer->data[length] = 0;
+
+        conn->read_buffer = buffer;
+    }
+
+    scratch->length = 0;
+    scratch->current = 0;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// unread data as up to iovcnt pieces in order, returns the number filled
+int slice_connection_peek_read_iovec(SliceConnection *conn, struct iovec *iov, int iovcnt, char *err)
+{
+    SliceBuffer *buffer;
+    int count = 0;
+
+    if (!conn || !iov || iovcnt <= 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return -1;
+    }
+
+    if (!(buffer = conn->read_buffer)) return 0;
+
+    if (buffer->current < buffer->length) {
+        iov[count].iov_base = buffer->data + buffer->current;
+        iov[count].iov_len = buffer->length - buffer->current;
+        count++;
+    }
+
+    if (!(buffer = conn->read_segments)) return count;
+
+    do {
+        if (count >= iovcnt) break;
+
+        if (buffer->length > 0) {
+            iov[count].iov_base = buffer->data;
+            iov[count].iov_len = buffer->length;
+            count++;
+        }
+
+        buffer = (SliceBuffer*)buffer->obj.next;
+    } while (buffer != conn->read_segments);
+
+    return count;
+}
+
+unsigned long long slice_connection_get_read_length(SliceConnection *conn)
+{
+    SliceBuffer *buffer;
+    unsigned long long length;
+
+    if (!conn || !conn->read_buffer) return 0;
+
+    length = conn->read_buffer->length - conn->read_buffer->current;
+
+    if (!(buffer = conn->read_segments)) return length;
+
+    do {
+        length += buffer->length;
+        buffer = (SliceBuffer*)buffer->obj.next;
+    } while (buffer != conn->read_segments);
+
+    return length;
 }
 
 SliceBuffer *slice_connection_get_read_buffer(SliceConnection *conn)
@@ -577,6 +1671,8 @@ SliceBuffer *slice_connection_get_read_buffer(SliceConnection *conn)
 
 SliceReturnType slice_connection_clear_read_buffer(SliceConnection *conn, char *err)
 {
+    SliceBuffer *buffer;
+
     if (!conn) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
@@ -587,6 +1683,11 @@ SliceReturnType slice_connection_clear_read_buffer(SliceConnection *conn, char *
         conn->read_buffer->current = 0;
     }
 
+    while ((buffer = conn->read_segments)) {
+        SliceListRemove(&(conn->read_segments), buffer, NULL);
+        SliceBufferRelease(conn->mainloop_event->mainloop, &buffer, NULL);
+    }
+
     return SLICE_RETURN_NORMAL;
 }
 
@@ -597,16 +1698,168 @@ SliceReturnType slice_connection_write_buffer(SliceConnection *conn, SliceBuffer
         return SLICE_RETURN_ERROR;
     }
 
-    SliceListAppend(&(conn->write_buffer), buffer, NULL);
+    // write stall is measured from the moment the queue stops being empty
+    if (!conn->write_buffer && conn->write_timeout) {
+        conn->last_write = SliceTimerNow();
+        SliceListAppend(&(conn->write_buffer), buffer, NULL);
+        slice_connection_deadline_arm(conn);
+    } else {
+        SliceListAppend(&(conn->write_buffer), buffer, NULL);
+    }
+
+    if (buffer->length > buffer->current) {
+        slice_connection_write_queue_account(conn, (long long)(buffer->length - buffer->current));
+        slice_connection_write_watermark_check(conn);
+    }
 
     return SLICE_RETURN_NORMAL;
 }
 
+// the iovec is copied into one pooled buffer, the caller keeps its memory
+SliceReturnType slice_connection_writev(SliceConnection *conn, const struct iovec *iov, int iovcnt, char *err)
+{
+    SliceBuffer *buffer;
+    size_t total = 0;
+    int i;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!conn || !iov || iovcnt <= 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    for (i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+    if (total == 0) return SLICE_RETURN_NORMAL;
+
+    if (total > UINT_MAX - 1) {
+        if (err) sprintf(err, "Vector length [%zu] is too large", total);
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(buffer = SliceBufferCreate(conn->mainloop_event->mainloop, (unsigned int)total, err_buff))) {
+        if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        memcpy(buffer->data + buffer->length, iov[i].iov_base, iov[i].iov_len);
+        buffer->length += (unsigned int)iov[i].iov_len;
+    }
+
+    return slice_connection_write_buffer(conn, buffer, err);
+}
+
+// queue a reference to buffer, each connection keeps its own offset and the data is never copied
+SliceReturnType slice_connection_write_shared(SliceConnection *conn, SliceBuffer *buffer, char *err)
+{
+    SliceBuffer *entry;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!conn || !buffer || buffer->source != SLICE_BUFFER_SOURCE_DATA) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (buffer->obj.next || buffer->obj.prev) {
+        if (err) sprintf(err, "Shared buffer is queued on its own");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (buffer->length == 0) return SLICE_RETURN_NORMAL;
+
+    // the entry only carries the send offset, the bytes stay in buffer
+    if (!(entry = SliceBufferCreateHeader(conn->mainloop_event->mainloop, err_buff))) {
+        if (err) sprintf(err, "SliceBufferCreateHeader return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    SliceBufferRetain(buffer, NULL);
+
+    entry->source = SLICE_BUFFER_SOURCE_SHARED;
+    entry->source_buffer = buffer;
+    entry->length = buffer->length;
+
+    return slice_connection_write_buffer(conn, entry, err);
+}
+
+// queue length bytes of fd behind the buffers already queued, a regular file from offset or a pipe from its head
+SliceReturnType slice_connection_write_file(SliceConnection *conn, int fd, unsigned long long offset, unsigned int length, char *err)
+{
+    SliceBuffer *buffer;
+    SliceBufferSource source;
+    struct stat st;
+    int source_fd;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!conn || fd < 0 || length == 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (conn->ssl_ctx || !(conn->mode & SLICE_CONNECTION_MODE_TCP)) {
+        if (err) sprintf(err, "File entries need a plain TCP connection");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        if (err) sprintf(err, "fstat return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        source = SLICE_BUFFER_SOURCE_FILE;
+    } else if (S_ISFIFO(st.st_mode)) {
+        source = SLICE_BUFFER_SOURCE_PIPE;
+    } else {
+        if (err) sprintf(err, "FD [%d] is neither a regular file nor a pipe", fd);
+        return SLICE_RETURN_ERROR;
+    }
+
+    // the entry keeps its own descriptor, the caller may close fd right away
+    if ((source_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        if (err) sprintf(err, "fcntl dup return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+    // the bytes come from source_fd, the entry only carries the offsets
+    if (!(buffer = SliceBufferCreateHeader(conn->mainloop_event->mainloop, err_buff))) {
+        if (err) sprintf(err, "SliceBufferCreateHeader return error [%s]", err_buff);
+        close(source_fd);
+        return SLICE_RETURN_ERROR;
+    }
+
+    buffer->source = source;
+    buffer->source_fd = source_fd;
+    buffer->source_offset = offset;
+    buffer->length = length;
+
+    return slice_connection_write_buffer(conn, buffer, err);
+}
+
 char *slice_connection_get_peer_ip(SliceConnection *conn)
 {
     if (!conn) return "";
 
-    return (conn->mode == SLICE_CONNECTION_MODE_IP4_TCP) ? conn->args.ip4_tcp.peer_ip : (conn->mode == SLICE_CONNECTION_MODE_IP6_TCP) ? conn->args.ip6_tcp.peer_ip : conn->args.ip4_udp.peer_ip;
+    if (conn->mode == SLICE_CONNECTION_MODE_IP4_TCP) {
+        if (!conn->args.ip4_tcp.peer_ip[0] && !inet_ntop(AF_INET, &(conn->args.ip4_tcp.peer_addr.sin_addr), conn->args.ip4_tcp.peer_ip, sizeof(conn->args.ip4_tcp.peer_ip))) {
+            conn->args.ip4_tcp.peer_ip[0] = 0;
+        }
+
+        return conn->args.ip4_tcp.peer_ip;
+    } else if (conn->mode == SLICE_CONNECTION_MODE_IP6_TCP) {
+        if (!conn->args.ip6_tcp.peer_ip[0] && !inet_ntop(AF_INET6, &(conn->args.ip6_tcp.peer_addr.sin6_addr), conn->args.ip6_tcp.peer_ip, sizeof(conn->args.ip6_tcp.peer_ip))) {
+            conn->args.ip6_tcp.peer_ip[0] = 0;
+        }
+
+        return conn->args.ip6_tcp.peer_ip;
+    }
+
+    return conn->args.ip4_udp.peer_ip;
 }
 
 int slice_connection_get_peer_port(SliceConnection *conn)
@@ -2,6 +2,7 @@
 #define _SLICE_CONNECTION_H_
 
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include "slice-buffer.h"
 #include "slice-mainloop.h"
@@ -10,6 +11,11 @@
 #define DEFAULT_READ_BUFFER_SIZE    (SLICE_BUFFER_BLOCK_SIZE - 1)
 #define MIN_READ_BUFFER_SIZE        (2 * 1024)
 
+#define SLICE_CONNECTION_DEFAULT_READ_BUDGET    (64 * 1024)
+#define SLICE_CONNECTION_READ_SEGMENT_SIZE      (128 * 1024)        // pool class of the blocks chained in segmented read mode
+#define SLICE_CONNECTION_MAX_READ_BUFFER_SIZE   (1024 * 1024 * 1024)    // contiguous read buffer, keeps the large buffer size math in range
+#define SLICE_CONNECTION_WRITE_IOV_MAX          1024        // IOV_MAX on Linux
+
 typedef struct slice_connection SliceConnection;
 typedef struct slice_connection_ip4_tcp SliceConnectionIP4TCP;
 typedef struct slice_connection_ip6_tcp SliceConnectionIP6TCP;
@@ -17,6 +23,7 @@ typedef struct slice_connection_ip4_udp SliceConnectionIP4UDP;
 
 typedef enum slice_connection_mode SliceConnectionMode;
 typedef enum slice_connection_type SliceConnectionType;
+typedef enum slice_connection_timeout SliceConnectionTimeout;
 
 enum slice_connection_type
 {
@@ -25,6 +32,14 @@ enum slice_connection_type
     SLICE_CONNECTION_TYPE_UNEXPECT = 3
 };
 
+enum slice_connection_timeout
+{
+    SLICE_CONNECTION_TIMEOUT_IDLE = 0,      // no read or write progress
+    SLICE_CONNECTION_TIMEOUT_HANDSHAKE,     // SSL handshake not finished
+    SLICE_CONNECTION_TIMEOUT_WRITE,         // queued write data not draining
+    SLICE_CONNECTION_TIMEOUT_READ_BUFFER    // empty read buffer goes back to the pool, the connection stays open
+};
+
 enum slice_connection_mode
 {
     SLICE_CONNECTION_MODE_IP4_TCP = 1,
@@ -39,17 +54,40 @@ extern "C" {
 
 SliceReturnType slice_connection_init(SliceConnection *conn, int fd, char *err);
 SliceConnection *slice_connection_create(SliceMainloopEvent *mainloop_event, int fd, SliceConnectionMode mode, SliceConnectionType type, char *err);
+SliceConnection *slice_connection_create_accepted(SliceMainloopEvent *mainloop_event, int fd, struct sockaddr *addr, int nonblocking, SliceConnectionMode mode, SliceConnectionType type, char *err);
+SliceReturnType slice_connection_detach(SliceConnection *conn, char *err);
 SliceReturnType slice_connection_destroy(SliceConnection *conn, char *err);
 SliceReturnType slice_connection_set_ssl_context(SliceConnection *conn, SliceSSLContext *ssl_ctx, char *err);
 SliceReturnType slice_connection_set_close_callback(SliceConnection *conn, void(*close_callback)(SliceConnection*, void*, char*), char *err);
+SliceReturnType slice_connection_set_timeout(SliceConnection *conn, SliceConnectionTimeout type, unsigned int timeout, char *err);
+SliceReturnType slice_connection_set_read_budget(SliceConnection *conn, unsigned int budget, char *err);
+SliceReturnType slice_connection_set_busy_poll(SliceConnection *conn, unsigned int usec, char *err);
+SliceReturnType slice_connection_set_zerocopy(SliceConnection *conn, unsigned int threshold, char *err);
+SliceReturnType slice_connection_set_completion(SliceConnection *conn, char *err);
+int slice_connection_zerocopy_complete(SliceConnection *conn, char *err);
+SliceReturnType slice_connection_set_write_watermark(SliceConnection *conn, unsigned long long high, unsigned long long low, char *err);
+SliceReturnType slice_connection_set_write_callback(SliceConnection *conn, void(*write_blocked_callback)(SliceConnection*, void*), void(*write_drained_callback)(SliceConnection*, void*), char *err);
+SliceReturnType slice_connection_set_write_peer(SliceConnection *conn, SliceConnection *peer, char *err);
+unsigned long long slice_connection_get_write_queued(SliceConnection *conn);
 SliceReturnType slice_connection_socket_read(SliceConnection *connection, int *read_length, char *err);
+SliceReturnType slice_connection_socket_read_done(SliceConnection *conn, char *err);
 SliceReturnType slice_connection_socket_write(SliceConnection *conn, char *err);
 SliceReturnType slice_connection_set_read_buffer_size(SliceConnection *conn, unsigned int size, char *err);
 SliceReturnType slice_connection_need_read_buffer_size(SliceConnection *conn, unsigned int need_size, char *err);
 int slice_connection_fetch_read_buffer(SliceConnection *conn, char *out, unsigned int out_size, char *err);
+SliceReturnType slice_connection_peek_read_buffer(SliceConnection *conn, char **data, unsigned int *length, char *err);
+SliceReturnType slice_connection_consume_read_buffer(SliceConnection *conn, unsigned int length, char *err);
+SliceReturnType slice_connection_set_read_segmented(SliceConnection *conn, int enable, char *err);
+SliceReturnType slice_connection_set_read_scratch(SliceConnection *conn, int enable, char *err);
+SliceReturnType slice_connection_release_read_scratch(SliceConnection *conn, char *err);
+int slice_connection_peek_read_iovec(SliceConnection *conn, struct iovec *iov, int iovcnt, char *err);
+unsigned long long slice_connection_get_read_length(SliceConnection *conn);
 SliceBuffer *slice_connection_get_read_buffer(SliceConnection *conn);
 SliceReturnType slice_connection_clear_read_buffer(SliceConnection *conn, char *err);
 SliceReturnType slice_connection_write_buffer(SliceConnection *conn, SliceBuffer *buffer, char *err);
+SliceReturnType slice_connection_writev(SliceConnection *conn, const struct iovec *iov, int iovcnt, char *err);
+SliceReturnType slice_connection_write_shared(SliceConnection *conn, SliceBuffer *buffer, char *err);
+SliceReturnType slice_connection_write_file(SliceConnection *conn, int fd, unsigned long long offset, unsigned int length, char *err);
 char *slice_connection_get_peer_ip(SliceConnection *conn);
 int slice_connection_get_peer_port(SliceConnection *conn);
 struct sockaddr *slice_connection_get_peer_sockaddr(SliceConnection *conn);
@@ -61,17 +99,39 @@ SliceMainloopEvent *slice_connection_get_mainloop_event(SliceConnection *conn);
 
 #define SliceConnectionInit(_conn, _fd, _err) slice_connection_init((SliceConnection*)_conn, _fd, _err)
 #define SliceConnectionCreate(_event, _fd, _mode, _type, _err) slice_connection_create((SliceMainloopEvent*)_event, _fd, _mode, _type, _err)
+#define SliceConnectionCreateAccepted(_event, _fd, _addr, _nonblocking, _mode, _type, _err) slice_connection_create_accepted((SliceMainloopEvent*)_event, _fd, _addr, _nonblocking, _mode, _type, _err)
+#define SliceConnectionDetach(_conn, _err) slice_connection_detach(_conn, _err)
 #define SliceConnectionDestroy(_conn, _err) slice_connection_destroy(_conn, _err)
 #define SliceConnectionSetSSLContext(_conn, _ssl_ctx, _err) slice_connection_set_ssl_context(_conn, _ssl_ctx, _err)
 #define SliceConnectionSetCloseCallback(_conn, _close_callback, _err) slice_connection_set_close_callback(_conn, _close_callback, _err)
+#define SliceConnectionSetTimeout(_conn, _type, _timeout, _err) slice_connection_set_timeout(_conn, _type, _timeout, _err)
+#define SliceConnectionSetReadBudget(_conn, _budget, _err) slice_connection_set_read_budget(_conn, _budget, _err)
+#define SliceConnectionSetBusyPoll(_conn, _usec, _err) slice_connection_set_busy_poll(_conn, _usec, _err)
+#define SliceConnectionSetZerocopy(_conn, _threshold, _err) slice_connection_set_zerocopy(_conn, _threshold, _err)
+#define SliceConnectionSetCompletion(_conn, _err) slice_connection_set_completion(_conn, _err)
+#define SliceConnectionZerocopyComplete(_conn, _err) slice_connection_zerocopy_complete(_conn, _err)
+#define SliceConnectionSetWriteWatermark(_conn, _high, _low, _err) slice_connection_set_write_watermark(_conn, _high, _low, _err)
+#define SliceConnectionSetWriteCallback(_conn, _blocked_callback, _drained_callback, _err) slice_connection_set_write_callback(_conn, _blocked_callback, _drained_callback, _err)
+#define SliceConnectionSetWritePeer(_conn, _peer, _err) slice_connection_set_write_peer(_conn, _peer, _err)
+#define SliceConnectionGetWriteQueued(_conn) slice_connection_get_write_queued(_conn)
 //#define SliceConnectionSocketRead(_conn, _read_length, _err) slice_connection_read(_conn, _read_length, _err)
 //#define SliceConnectionSocketWrite(_conn, _err) slice_connection_write(_conn, _err)
 #define SliceConnectionSetReadBufferSize(_conn, _size, _err) slice_connection_set_read_buffer_size(_conn, _size, _err)
 #define SliceConnectionNeedReadBufferSize(_conn, _need_size, _err) slice_connection_need_read_buffer_size(_conn, _need_size, _err)
 #define SliceConnectionFetchReadBuffer(_conn, _out, _out_size, _err) slice_connection_fetch_read_buffer(_conn, _out, _out_size, _err)
+#define SliceConnectionPeekReadBuffer(_conn, _data, _length, _err) slice_connection_peek_read_buffer(_conn, _data, _length, _err)
+#define SliceConnectionConsumeReadBuffer(_conn, _length, _err) slice_connection_consume_read_buffer(_conn, _length, _err)
+#define SliceConnectionSetReadSegmented(_conn, _enable, _err) slice_connection_set_read_segmented(_conn, _enable, _err)
+#define SliceConnectionSetReadScratch(_conn, _enable, _err) slice_connection_set_read_scratch(_conn, _enable, _err)
+#define SliceConnectionReleaseReadScratch(_conn, _err) slice_connection_release_read_scratch(_conn, _err)
+#define SliceConnectionPeekReadIovec(_conn, _iov, _iovcnt, _err) slice_connection_peek_read_iovec(_conn, _iov, _iovcnt, _err)
+#define SliceConnectionGetReadLength(_conn) slice_connection_get_read_length(_conn)
 #define SliceConnectionGetReadBuffer(_conn) slice_connection_get_read_buffer(_conn)
 #define SliceConnectionClearReadBuffer(_conn, _err) slice_connection_clear_read_buffer(_conn, _err)
 #define SliceConnectionWriteBuffer(_conn, _buffer, _err) slice_connection_write_buffer(_conn, _buffer, _err)
+#define SliceConnectionWritev(_conn, _iov, _iovcnt, _err) slice_connection_writev(_conn, _iov, _iovcnt, _err)
+#define SliceConnectionWriteShared(_conn, _buffer, _err) slice_connection_write_shared(_conn, _buffer, _err)
+#define SliceConnectionWriteFile(_conn, _fd, _offset, _length, _err) slice_connection_write_file(_conn, _fd, _offset, _length, _err)
 #define SliceConnectionGetPeerIP(_conn) slice_connection_get_peer_ip(_conn)
 #define SliceConnectionGetPeerPort(_conn) slice_connection_get_peer_port(_conn)
 #define SliceConnectionGetPeerSockAddr(_conn) slice_connection_get_peer_sockaddr(_conn)
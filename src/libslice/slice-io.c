@@ -7,7 +7,7 @@
 
 SliceReturnType slice_oi_init(SliceIO *io, int fd, char *err)
 {
-    if (!io || fd < 0 || fd > 0xffff) {
+    if (!io || fd < 0) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
@@ -24,7 +24,7 @@ SliceReturnType slice_io_close(SliceIO *io, char *err)
         return SLICE_RETURN_ERROR;
     }
 
-    if (io->fd >= 0 && io->fd <= 0xffff) {
+    if (io->fd >= 0) {
         close(io->fd);
         io->fd = -1;
     }
@@ -41,7 +41,7 @@ int slice_io_read(SliceIO *io, void *buffer, unsigned int buffer_size, char *err
         return -1;
     }
 
-    if (io->fd < 0 || io->fd > 0xffff) {
+    if (io->fd < 0) {
         if (err) sprintf(err, "Invalid IO file descriptor");
         return -1;
     }
@@ -62,7 +62,7 @@ int slice_io_write(SliceIO *io, void *buffer, unsigned int buffer_size, char *er
         return -1;
     }
 
-    if (io->fd < 0 || io->fd > 0xffff) {
+    if (io->fd < 0) {
         if (err) sprintf(err, "Invalid IO file descriptor");
         return -1;
     }
@@ -1,22 +1,105 @@
+#define _GNU_SOURCE
 
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "slice-mainloop.h"
+#include "slice-uring.h"
+#include "slice-timer.h"
+
+// fd indexed elements live in pages allocated on first use
+#define SLICE_MAINLOOP_ELEMENT_PAGE_BITS                10
+#define SLICE_MAINLOOP_ELEMENT_PAGE_SIZE                (1 << SLICE_MAINLOOP_ELEMENT_PAGE_BITS)
+#define SLICE_MAINLOOP_ELEMENT_PAGE_MASK                (SLICE_MAINLOOP_ELEMENT_PAGE_SIZE - 1)
+
+// smallest busy poll spin window in us, the window shrinks toward it while the loop is idle
+#define SLICE_MAINLOOP_BUSY_POLL_MIN_SPIN               8
+
+// io_uring poll requests carry the fd and an arm sequence, stale completions are dropped; the top bit is left to I/O requests
+#define SLICE_MAINLOOP_URING_SEQ_MASK                   0x7fffffffU
+#define SLICE_MAINLOOP_URING_USER_DATA(_fd, _seq)       ((((unsigned long long)((_seq) & SLICE_MAINLOOP_URING_SEQ_MASK)) << 32) | (unsigned int)(_fd))
+
+// I/O requests carry their completion state and the operation in the low bits
+#define SLICE_MAINLOOP_URING_IO_RECV                    1
+#define SLICE_MAINLOOP_URING_IO_SEND                    2
+#define SLICE_MAINLOOP_URING_IO_ACCEPT                  3
+#define SLICE_MAINLOOP_URING_IO_OP_MASK                 3ULL
+#define SLICE_MAINLOOP_URING_IO_USER_DATA(_io, _op)     ((unsigned long long)(unsigned long)(_io) | (_op))
+
+// staging buffers of completion sockets, fills the 32K pool class with its terminator
+#define SLICE_MAINLOOP_URING_IO_SIZE                    (32 * 1024 - 1)
+
+typedef struct slice_mainloop_uring_io SliceMainloopUringIO;
+
+// a socket reading and writing through io_uring requests, one request of each kind in flight,
+// outlives the removal of its fd as an orphan until the requests in flight completed
+struct slice_mainloop_uring_io
+{
+    SliceObject obj;
+
+    SliceMainloopEpollElement *element;     // NULL for an orphan
+    int fd;
+    int listen;
+
+    int recv_armed;
+    int recv_eof;
+    int recv_error;                         // errno of a failed recv, reported once the data before it was taken
+    SliceBuffer *recv_buffer;               // [current, length) received and not taken yet
+
+    int send_armed;
+    int send_error;                         // errno of a failed send, reported by the next one
+    SliceBuffer *send_buffer;               // [current, length) handed to the kernel, no more is taken until it completed
+
+    int accept_armed;
+    int accept_fd;                          // accepted and not taken yet, -1 when none
+    int accept_error;
+    struct sockaddr_storage accept_addr;
+    socklen_t accept_addrlen;
+};
+
+typedef struct slice_mainloop_task SliceMainloopTask;
+
+struct slice_mainloop_task
+{
+    SliceMainloopTask *next;
+
+    void(*callback)(SliceMainloop*, void*);
+    void *arg;
+};
 
 struct slice_mainloop_epoll
 {
     int epoll_fd;
 
+    SliceMainloopEngine engine;
+    SliceUring *uring;
+
     int timeout;
     int max_fetch_event;
-    int max_fd;
 
     struct epoll_event *event_bucket;
-    SliceMainloopEpollElement *element_table;
+
+    // pages never move, element pointers stay valid while the directory grows
+    SliceMainloopEpollElement **element_pages;
+    int element_page_count;
+
+    // elements with interest changes not yet applied, flushed once before waiting
+    SliceMainloopEpollElement *dirty_list;
+
+    // elements left with unread data by their read budget, read again next iteration without a new edge
+    SliceMainloopEpollElement *ready_list;
+    unsigned long long ready_pass;  // bumped every iteration, tags the elements its ready list already read
+
+    // elements with output queued this iteration, written once before waiting instead of after an EPOLLOUT round trip
+    SliceMainloopEpollElement *flush_list;
+
+    // completion state of removed fds with requests still in flight
+    SliceMainloopUringIO *uring_io_orphans;
 };
 
 struct slice_mainloop_epoll_element
@@ -28,6 +111,24 @@ struct slice_mainloop_epoll_element
     int need_read;
     int need_write;
 
+    uint32_t events;                // mask registered in epoll
+
+    int dirty;
+    int dirty_fd;
+    int rearm;                      // re-register even if the mask is unchanged
+    SliceMainloopEpollElement *dirty_next;
+
+    int ready;
+    SliceMainloopEpollElement *ready_next;
+    unsigned long long ready_pass;  // read from the ready list in that iteration, its EPOLLIN of the same batch is skipped
+
+    int flush;
+    SliceMainloopEpollElement *flush_next;
+
+    unsigned int uring_armed;
+    unsigned int uring_seq;
+    SliceMainloopUringIO *uring_io;         // reads, writes and accepts go through requests, polls only serve sendfile and splice
+
     SliceReturnType(*write_cb)(SliceMainloopEpoll*, SliceMainloopEpollElement*, struct epoll_event, void*);
     SliceReturnType(*read_cb)(SliceMainloopEpoll*, SliceMainloopEpollElement*, struct epoll_event, void*);
     SliceReturnType(*close_cb)(SliceMainloopEpoll*, SliceMainloopEpollElement*, struct epoll_event, void*);
@@ -40,12 +141,28 @@ struct slice_mainloop
 
     int quit;
 
+    // tasks posted from other threads, pushed lock-free and taken all at once by the loop
+    SliceMainloopTask *task_list;
+    int wakeup_fd;
+
     void *user_data;
 
     SliceMainloopEpoll *epoll;
 
-    SliceBuffer *buffer_bucket;
-    int buffer_bucket_count;
+    SliceTimerWheel *timer_wheel;
+
+    SliceMainloopStats *stats;      // kept once allocated, a loop switching it off mid iteration still writes to valid memory
+    int stats_enabled;
+
+    // zero timeout waits before blocking, the window adapts between the minimum and the budget
+    unsigned int busy_poll_budget;  // us, 0 disables
+    unsigned int busy_poll_spin;    // current window in us
+
+    SliceBufferPool *buffer_pool;
+
+    unsigned long long write_queued;    // bytes waiting in the write queues of this loop's connections
+
+    SliceBuffer *read_scratch;          // created on first use, never handed out across a callback return
 
     SliceReturnType(*init_mainloop_cb)(SliceMainloop *mainloop, void *user_data, char *err);
 
@@ -58,13 +175,16 @@ struct slice_mainloop
     SliceReturnType(*finish_mainloop_cb)(SliceMainloop *mainloop, void *user_data, char *err);
 };
 
+SliceReturnType slice_mainloop_epoll_event_update(SliceMainloop *mainloop, int fd, char *err);
+static void slice_mainloop_epoll_event_mark(SliceMainloop *mainloop, SliceMainloopEpollElement *element, int fd);
+static void slice_mainloop_uring_io_cleanup(SliceMainloop *mainloop);
+
 SliceMainloop *slice_mainloop_create(int epoll_max_fd, int epoll_max_fetch_event, int epoll_timeout, char *err)
 {
     SliceMainloop *mainloop;
     SliceMainloopEpoll *epoll;
-    SliceMainloopEpollElement *element_table;
 
-    int i;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
     if (!(mainloop = (SliceMainloop*)malloc(sizeof(SliceMainloop)))) {
         if (err) sprintf(err, "Can't allocate mainloop memory");
@@ -82,7 +202,6 @@ SliceMainloop *slice_mainloop_create(int epoll_max_fd, int epoll_max_fetch_event
     memset(mainloop->epoll, 0, sizeof(SliceMainloopEpoll));
 
     epoll->max_fetch_event = epoll_max_fetch_event;
-    epoll->max_fd = epoll_max_fd;
     epoll->timeout = epoll_timeout;
 
     if ((epoll->epoll_fd = epoll_create(epoll_max_fetch_event)) < 0) {
@@ -92,24 +211,21 @@ SliceMainloop *slice_mainloop_create(int epoll_max_fd, int epoll_max_fetch_event
         return NULL;
     }
 
-    if (!(element_table = epoll->element_table = (SliceMainloopEpollElement*)malloc(sizeof(SliceMainloopEpollElement) * epoll_max_fd))) {
-        if (err) sprintf(err, "Can't allocate mainloop epoll element table memory");
+    // max fd is only a sizing hint for the page directory, pages are allocated on demand
+    epoll->element_page_count = (epoll_max_fd > 0) ? ((epoll_max_fd + SLICE_MAINLOOP_ELEMENT_PAGE_MASK) >> SLICE_MAINLOOP_ELEMENT_PAGE_BITS) : 1;
+
+    if (!(epoll->element_pages = (SliceMainloopEpollElement**)calloc(epoll->element_page_count, sizeof(SliceMainloopEpollElement*)))) {
+        if (err) sprintf(err, "Can't allocate mainloop epoll element directory memory");
         close(epoll->epoll_fd);
         free(epoll);
         free(mainloop);
         return NULL;
     }
 
-    memset(epoll->element_table, 0, sizeof(SliceMainloopEpollElement) * epoll_max_fd);
-
-    for (i = 0; i < epoll_max_fd; i++) {
-        element_table[i].fd = -1;
-    }
-
     if (!(epoll->event_bucket = (struct epoll_event*)malloc(sizeof(struct epoll_event) * epoll_max_fetch_event))) {
         if (err) sprintf(err, "Can't allocate mainloop epoll event bucket memory");
         close(epoll->epoll_fd);
-        free(element_table);
+        free(epoll->element_pages);
         free(epoll);
         free(mainloop);
         return NULL;
@@ -117,34 +233,94 @@ SliceMainloop *slice_mainloop_create(int epoll_max_fd, int epoll_max_fetch_event
 
     memset(epoll->event_bucket, 0, sizeof(struct epoll_event) * epoll_max_fetch_event);
 
+    if (!(mainloop->timer_wheel = SliceTimerWheelCreate(err))) {
+        close(epoll->epoll_fd);
+        free(epoll->event_bucket);
+        free(epoll->element_pages);
+        free(epoll);
+        free(mainloop);
+        return NULL;
+    }
+
+    if (!(mainloop->buffer_pool = SliceBufferPoolCreate(err))) {
+        mainloop->wakeup_fd = -1;
+        slice_mainloop_destroy(mainloop, NULL);
+        return NULL;
+    }
+
+    if ((mainloop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        if (err) sprintf(err, "eventfd return error [%s]", strerror(errno));
+        mainloop->wakeup_fd = -1;
+        slice_mainloop_destroy(mainloop, NULL);
+        return NULL;
+    }
+
+    slice_mainloop_epoll_event_add_read(mainloop, mainloop->wakeup_fd, NULL);
+
+    if (slice_mainloop_epoll_event_update(mainloop, mainloop->wakeup_fd, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "Add wakeup fd return error [%s]", err_buff);
+        slice_mainloop_destroy(mainloop, NULL);
+        return NULL;
+    }
+
     return mainloop;
 }
 
 SliceReturnType slice_mainloop_destroy(SliceMainloop *mainloop, char *err)
 {
     SliceMainloopEvent *mainloop_event;
-    SliceBuffer *buffer;
+    SliceMainloopTask *task;
+    int i;
 
     if (!mainloop) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
+    // tasks never run are dropped, their args belong to the poster
+    while ((task = mainloop->task_list)) {
+        mainloop->task_list = task->next;
+        free(task);
+    }
+
+    if (mainloop->wakeup_fd >= 0) {
+        slice_mainloop_epoll_event_remove(mainloop, mainloop->wakeup_fd, NULL);
+        close(mainloop->wakeup_fd);
+        mainloop->wakeup_fd = -1;
+    }
+
     while ((mainloop_event = mainloop->event_list)) {
         slice_mainloop_event_remove(mainloop, mainloop_event, NULL);
-        mainloop->event_list_count--;
         free(mainloop_event);
     }
 
-    while ((buffer = mainloop->buffer_bucket)) {
-        SliceListRemove(&(mainloop->buffer_bucket), buffer, NULL);
-        free(buffer);
+    if (mainloop->read_scratch) SliceBufferRelease(mainloop, &(mainloop->read_scratch), NULL);
+
+    slice_mainloop_uring_io_cleanup(mainloop);
+
+    if (mainloop->buffer_pool) {
+        SliceBufferPoolDestroy(mainloop->buffer_pool, NULL);
+        mainloop->buffer_pool = NULL;
+    }
+
+    if (mainloop->timer_wheel) {
+        SliceTimerWheelDestroy(mainloop->timer_wheel, NULL);
+        mainloop->timer_wheel = NULL;
+    }
+
+    if (mainloop->stats) {
+        free(mainloop->stats);
+        mainloop->stats = NULL;
     }
 
     if (mainloop->epoll) {
-        if (mainloop->epoll->element_table) {
-            free(mainloop->epoll->element_table);
-            mainloop->epoll->element_table = NULL;
+        if (mainloop->epoll->element_pages) {
+            for (i = 0; i < mainloop->epoll->element_page_count; i++) {
+                if (mainloop->epoll->element_pages[i]) free(mainloop->epoll->element_pages[i]);
+            }
+
+            free(mainloop->epoll->element_pages);
+            mainloop->epoll->element_pages = NULL;
         }
 
         if (mainloop->epoll->event_bucket) {
@@ -152,6 +328,11 @@ SliceReturnType slice_mainloop_destroy(SliceMainloop *mainloop, char *err)
             mainloop->epoll->event_bucket = NULL;
         }
 
+        if (mainloop->epoll->uring) {
+            SliceUringDestroy(mainloop->epoll->uring, NULL);
+            mainloop->epoll->uring = NULL;
+        }
+
         close(mainloop->epoll->epoll_fd);
 
         free(mainloop->epoll);
@@ -163,19 +344,62 @@ SliceReturnType slice_mainloop_destroy(SliceMainloop *mainloop, char *err)
     return SLICE_RETURN_NORMAL;
 }
 
+// element of an fd already seen by this loop, NULL otherwise
+static SliceMainloopEpollElement *slice_mainloop_epoll_lookup_element(SliceMainloopEpoll *epoll, int fd)
+{
+    int page;
+
+    if (fd < 0) return NULL;
+
+    page = fd >> SLICE_MAINLOOP_ELEMENT_PAGE_BITS;
+
+    if (page >= epoll->element_page_count || !epoll->element_pages[page]) return NULL;
+
+    return &(epoll->element_pages[page][fd & SLICE_MAINLOOP_ELEMENT_PAGE_MASK]);
+}
+
 SliceMainloopEpollElement *slice_mainloop_epoll_get_event_element(SliceMainloop *mainloop, int fd, char *err)
 {
-    if (!mainloop || fd < 0 || fd > 0xffff) {
+    SliceMainloopEpoll *epoll;
+    SliceMainloopEpollElement **pages, *element;
+    int page, page_count, i;
+
+    if (!mainloop || fd < 0) {
         if (err) sprintf(err, "Invalid parameter");
         return NULL;
     }
 
-    if (fd >= mainloop->epoll->max_fd) {
-        if (err) sprintf(err, "FD [%d] table exceed, max [%d]", fd, mainloop->epoll->max_fd - 1);
+    epoll = mainloop->epoll;
+
+    if ((element = slice_mainloop_epoll_lookup_element(epoll, fd))) return element;
+
+    page = fd >> SLICE_MAINLOOP_ELEMENT_PAGE_BITS;
+
+    if (page >= epoll->element_page_count) {
+        page_count = epoll->element_page_count * 2;
+        if (page_count <= page) page_count = page + 1;
+
+        if (!(pages = (SliceMainloopEpollElement**)realloc(epoll->element_pages, sizeof(SliceMainloopEpollElement*) * page_count))) {
+            if (err) sprintf(err, "Can't grow element directory to [%d] pages", page_count);
+            return NULL;
+        }
+
+        memset(pages + epoll->element_page_count, 0, sizeof(SliceMainloopEpollElement*) * (page_count - epoll->element_page_count));
+
+        epoll->element_pages = pages;
+        epoll->element_page_count = page_count;
+    }
+
+    if (!(epoll->element_pages[page] = (SliceMainloopEpollElement*)calloc(SLICE_MAINLOOP_ELEMENT_PAGE_SIZE, sizeof(SliceMainloopEpollElement)))) {
+        if (err) sprintf(err, "Can't allocate element page for FD [%d]", fd);
         return NULL;
     }
 
-    return &(mainloop->epoll->element_table[fd]);
+    for (i = 0; i < SLICE_MAINLOOP_ELEMENT_PAGE_SIZE; i++) {
+        epoll->element_pages[page][i].fd = -1;
+    }
+
+    return &(epoll->element_pages[page][fd & SLICE_MAINLOOP_ELEMENT_PAGE_MASK]);
 }
 
 SliceReturnType slice_mainloop_epoll_set_callback(SliceMainloop *mainloop, int fd, SliceMainloopEpollEventCallback flag, void *callback, char *err)
@@ -215,332 +439,1339 @@ SliceReturnType slice_mainloop_epoll_set_callback(SliceMainloop *mainloop, int f
     return SLICE_RETURN_NORMAL;
 }
 
-SliceReturnType slice_mainloop_epoll_event_update(SliceMainloop *mainloop, int fd, char *err)
+static void slice_mainloop_uring_io_free(SliceMainloop *mainloop, SliceMainloopUringIO *io)
+{
+    if (io->recv_buffer) SliceBufferRelease(mainloop, &(io->recv_buffer), NULL);
+    if (io->send_buffer) SliceBufferRelease(mainloop, &(io->send_buffer), NULL);
+    if (io->accept_fd >= 0) close(io->accept_fd);
+
+    free(io);
+}
+
+// the fd goes away, reads and accepts in flight are cancelled, a send in flight finishes like bytes left in the socket buffer
+static void slice_mainloop_uring_io_detach(SliceMainloop *mainloop, SliceMainloopUringIO *io)
 {
+    SliceUring *uring = mainloop->epoll->uring;
+
+    io->element = NULL;
+
+    if (io->recv_armed) SliceUringCancel(uring, SLICE_MAINLOOP_URING_IO_USER_DATA(io, SLICE_MAINLOOP_URING_IO_RECV), NULL);
+    if (io->accept_armed) SliceUringCancel(uring, SLICE_MAINLOOP_URING_IO_USER_DATA(io, SLICE_MAINLOOP_URING_IO_ACCEPT), NULL);
+
+    if (!io->recv_armed && !io->send_armed && !io->accept_armed) {
+        slice_mainloop_uring_io_free(mainloop, io);
+        return;
+    }
+
+    SliceListAppend(&(mainloop->epoll->uring_io_orphans), io, NULL);
+}
+
+// the ring goes first, nothing completes into the staging buffers once they are back in the pool
+static void slice_mainloop_uring_io_cleanup(SliceMainloop *mainloop)
+{
+    SliceMainloopUringIO *io;
     SliceMainloopEpollElement *element;
-    uint32_t flags = 0;
-    struct epoll_event ev;
+    int i, j;
 
-    if (!mainloop || fd < 0 || fd > 0xffff) {
-        if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
+    if (!mainloop->epoll) return;
+
+    if (mainloop->epoll->uring) {
+        SliceUringDestroy(mainloop->epoll->uring, NULL);
+        mainloop->epoll->uring = NULL;
     }
 
-    if (fd >= mainloop->epoll->max_fd) {
-        if (err) sprintf(err, "FD [%d] table exceed, max [%d]", fd, mainloop->epoll->max_fd - 1);
-        return SLICE_RETURN_ERROR;
+    while ((io = mainloop->epoll->uring_io_orphans)) {
+        SliceListRemove(&(mainloop->epoll->uring_io_orphans), io, NULL);
+        slice_mainloop_uring_io_free(mainloop, io);
     }
 
-    element = &(mainloop->epoll->element_table[fd]);
+    for (i = 0; mainloop->epoll->element_pages && i < mainloop->epoll->element_page_count; i++) {
+        if (!mainloop->epoll->element_pages[i]) continue;
 
-    if (element->need_read) flags |= EPOLLIN;
-    if (element->need_write) flags |= EPOLLOUT;
-    if (flags) flags |= EPOLLET;
+        for (j = 0; j < SLICE_MAINLOOP_ELEMENT_PAGE_SIZE; j++) {
+            element = &(mainloop->epoll->element_pages[i][j]);
 
-    //printf("Update [%d][%d]\n", element->need_read, element->need_write);
+            if (element->uring_io) {
+                slice_mainloop_uring_io_free(mainloop, element->uring_io);
+                element->uring_io = NULL;
+            }
+        }
+    }
+}
 
-    memset(&ev, 0, sizeof(ev));
-    ev.data.fd = fd;
-    ev.events = flags;
+// the request for what the element waits on, data, an end or an error not taken yet runs the read callback again instead
+static SliceReturnType slice_mainloop_uring_io_arm(SliceMainloop *mainloop, SliceMainloopEpollElement *element, char *err)
+{
+    SliceMainloopUringIO *io = element->uring_io;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    if (element->fd == fd) {
-        if (epoll_ctl(mainloop->epoll->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
-            if (err) sprintf(err, "epoll_ctl return error [%s]", strerror(errno));
-            return SLICE_RETURN_ERROR;
-        }
-    } else {
-        if (epoll_ctl(mainloop->epoll->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
-            if (err) sprintf(err, "epoll_ctl return error [%s]", strerror(errno));
+    if (!element->need_read) return SLICE_RETURN_NORMAL;
+
+    if (io->listen) {
+        if (io->accept_armed) return SLICE_RETURN_NORMAL;
+        if (io->accept_fd >= 0 || io->accept_error) return slice_mainloop_epoll_event_ready(mainloop, io->fd, err);
+
+        io->accept_addrlen = sizeof(io->accept_addr);
+
+        if (SliceUringAccept(mainloop->epoll->uring, io->fd, (struct sockaddr*)&(io->accept_addr), &(io->accept_addrlen), SOCK_NONBLOCK | SOCK_CLOEXEC, SLICE_MAINLOOP_URING_IO_USER_DATA(io, SLICE_MAINLOOP_URING_IO_ACCEPT), err_buff) != SLICE_RETURN_NORMAL) {
+            if (err) sprintf(err, "SliceUringAccept return error [%s]", err_buff);
             return SLICE_RETURN_ERROR;
         }
+
+        io->accept_armed = 1;
+
+        return SLICE_RETURN_NORMAL;
     }
 
-    element->fd = fd;
+    if (io->recv_armed) return SLICE_RETURN_NORMAL;
+
+    if ((io->recv_buffer && io->recv_buffer->current < io->recv_buffer->length) || io->recv_eof || io->recv_error) {
+        return slice_mainloop_epoll_event_ready(mainloop, io->fd, err);
+    }
+
+    if (!io->recv_buffer && !(io->recv_buffer = SliceBufferCreate(mainloop, SLICE_MAINLOOP_URING_IO_SIZE, err_buff))) {
+        if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    io->recv_buffer->current = 0;
+    io->recv_buffer->length = 0;
+
+    if (SliceUringRecv(mainloop->epoll->uring, io->fd, io->recv_buffer->data, SLICE_MAINLOOP_URING_IO_SIZE, SLICE_MAINLOOP_URING_IO_USER_DATA(io, SLICE_MAINLOOP_URING_IO_RECV), err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceUringRecv return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    io->recv_armed = 1;
 
     return SLICE_RETURN_NORMAL;
 }
 
-SliceReturnType slice_mainloop_epoll_event_add_read(SliceMainloop *mainloop, int fd, char *err)
+// a completed request becomes the event its element waits for, or nothing
+static void slice_mainloop_uring_io_complete(SliceMainloop *mainloop, struct epoll_event *event)
 {
+    SliceMainloopUringIO *io;
     SliceMainloopEpollElement *element;
+    unsigned int op;
+    int res;
+
+    io = (SliceMainloopUringIO*)(unsigned long)(event->data.u64 & ~(SLICE_URING_USER_DATA_IO | SLICE_MAINLOOP_URING_IO_OP_MASK));
+    op = (unsigned int)(event->data.u64 & SLICE_MAINLOOP_URING_IO_OP_MASK);
+    res = (int)event->events;
+
+    event->events = 0;
+    event->data.u64 = 0;
+    event->data.fd = -1;
+
+    element = io->element;
+
+    switch (op) {
+        case SLICE_MAINLOOP_URING_IO_RECV:
+            io->recv_armed = 0;
+            if (!element) break;
+
+            if (res > 0) {
+                io->recv_buffer->length = (unsigned int)res;
+            } else if (res == 0) {
+                io->recv_eof = 1;
+            } else {
+                io->recv_error = -res;
+            }
 
-    if (!mainloop || fd < 0 || fd > 0xffff) {
-        if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
+            if (element->need_read) event->events = EPOLLIN;
+            break;
+
+        case SLICE_MAINLOOP_URING_IO_SEND:
+            io->send_armed = 0;
+            if (!element) break;
+
+            if (res < 0) {
+                io->send_error = -res;
+                io->send_buffer->current = io->send_buffer->length;
+            } else {
+                io->send_buffer->current += (unsigned int)res;
+            }
+
+            // a short send goes on with the rest, nothing else is taken meanwhile
+            if (io->send_buffer->current < io->send_buffer->length) {
+                if (SliceUringSend(mainloop->epoll->uring, io->fd, io->send_buffer->data + io->send_buffer->current, io->send_buffer->length - io->send_buffer->current, SLICE_MAINLOOP_URING_IO_USER_DATA(io, SLICE_MAINLOOP_URING_IO_SEND), NULL) == SLICE_RETURN_NORMAL) {
+                    io->send_armed = 1;
+                } else {
+                    io->send_error = EIO;
+                }
+            }
+
+            if (!io->send_armed) {
+                io->send_buffer->current = 0;
+                io->send_buffer->length = 0;
+
+                if (element->need_write) event->events = EPOLLOUT;
+            }
+            break;
+
+        case SLICE_MAINLOOP_URING_IO_ACCEPT:
+            io->accept_armed = 0;
+
+            if (!element) {
+                if (res >= 0) close(res);
+                break;
+            }
+
+            if (res >= 0) {
+                io->accept_fd = res;
+            } else {
+                io->accept_error = -res;
+            }
+
+            if (element->need_read) event->events = EPOLLIN;
+            break;
     }
 
-    if (fd >= mainloop->epoll->max_fd) {
-        if (err) sprintf(err, "FD [%d] table exceed, max [%d]", fd, mainloop->epoll->max_fd - 1);
-        return SLICE_RETURN_ERROR;
+    if (!element) {
+        if (!io->recv_armed && !io->send_armed && !io->accept_armed) {
+            SliceListRemove(&(mainloop->epoll->uring_io_orphans), io, NULL);
+            slice_mainloop_uring_io_free(mainloop, io);
+        }
+        return;
     }
 
-    element = &(mainloop->epoll->element_table[fd]);
+    // the next request is armed by the flush, once the callback took what this one brought
+    slice_mainloop_epoll_event_mark(mainloop, element, io->fd);
 
-    if (!element->need_read) {
-        element->need_read = 1;
-        return slice_mainloop_epoll_event_update(mainloop, fd, err);
-    }
-    
-    return SLICE_RETURN_NORMAL;
+    if (event->events) event->data.fd = io->fd;
 }
 
-SliceReturnType slice_mainloop_epoll_event_add_write(SliceMainloop *mainloop, int fd, char *err)
+// recv(2) for fd, a completion socket hands out what its last request received, EAGAIN until the next one completes
+int slice_mainloop_epoll_event_recv(SliceMainloop *mainloop, int fd, void *buffer, unsigned int length)
 {
     SliceMainloopEpollElement *element;
+    SliceMainloopUringIO *io;
+    unsigned int n;
 
-    if (!mainloop || fd < 0 || fd > 0xffff) {
-        if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
+    if (!mainloop || !(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd)) || !(io = element->uring_io)) {
+        return (int)recv(fd, buffer, length, 0);
     }
 
-    if (fd >= mainloop->epoll->max_fd) {
-        if (err) sprintf(err, "FD [%d] table exceed, max [%d]", fd, mainloop->epoll->max_fd - 1);
-        return SLICE_RETURN_ERROR;
-    }
+    if (io->recv_buffer && io->recv_buffer->current < io->recv_buffer->length) {
+        n = io->recv_buffer->length - io->recv_buffer->current;
+        if (n > length) n = length;
 
-    element = &(mainloop->epoll->element_table[fd]);
+        memcpy(buffer, io->recv_buffer->data + io->recv_buffer->current, n);
+        io->recv_buffer->current += n;
 
-    if (!element->need_write) {
-        element->need_write = 1;
-        return slice_mainloop_epoll_event_update(mainloop, fd, err);
+        if (io->recv_buffer->current == io->recv_buffer->length) slice_mainloop_epoll_event_mark(mainloop, element, fd);
+
+        return (int)n;
     }
 
-    return SLICE_RETURN_NORMAL;
+    if (io->recv_error) {
+        errno = io->recv_error;
+        io->recv_error = 0;
+        return -1;
+    }
+
+    if (io->recv_eof) return 0;
+
+    slice_mainloop_epoll_event_mark(mainloop, element, fd);
+
+    errno = EAGAIN;
+    return -1;
 }
 
-SliceReturnType slice_mainloop_epoll_event_remove_read(SliceMainloop *mainloop, int fd, char *err)
+// sendmsg(2) for fd, a completion socket copies what fits into its staging buffer and sends it with one request, EAGAIN while that is in flight
+ssize_t slice_mainloop_epoll_event_sendmsg(SliceMainloop *mainloop, int fd, const struct msghdr *msg, int flags)
 {
     SliceMainloopEpollElement *element;
+    SliceMainloopUringIO *io;
+    size_t n, total = 0;
+    int i;
 
-    if (!mainloop || fd < 0 || fd > 0xffff) {
-        if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
+    if (!mainloop || !(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd)) || !(io = element->uring_io)) {
+        return sendmsg(fd, msg, flags);
     }
 
-    if (fd >= mainloop->epoll->max_fd) {
-        if (err) sprintf(err, "FD [%d] table exceed, max [%d]", fd, mainloop->epoll->max_fd - 1);
-        return SLICE_RETURN_ERROR;
+    if (io->send_error) {
+        errno = io->send_error;
+        return -1;
     }
 
-    element = &(mainloop->epoll->element_table[fd]);
+    if (io->send_armed) {
+        errno = EAGAIN;
+        return -1;
+    }
 
-    if (element->need_read) {
-        element->need_read = 0;
-        return slice_mainloop_epoll_event_update(mainloop, fd, err);
+    if (!io->send_buffer && !(io->send_buffer = SliceBufferCreate(mainloop, SLICE_MAINLOOP_URING_IO_SIZE, NULL))) {
+        errno = ENOMEM;
+        return -1;
     }
 
-    return SLICE_RETURN_NORMAL;
+    for (i = 0; i < (int)msg->msg_iovlen && total < SLICE_MAINLOOP_URING_IO_SIZE; i++) {
+        n = msg->msg_iov[i].iov_len;
+        if (n > SLICE_MAINLOOP_URING_IO_SIZE - total) n = SLICE_MAINLOOP_URING_IO_SIZE - total;
+
+        memcpy(io->send_buffer->data + total, msg->msg_iov[i].iov_base, n);
+        total += n;
+    }
+
+    if (total == 0) return 0;
+
+    if (SliceUringSend(mainloop->epoll->uring, fd, io->send_buffer->data, (unsigned int)total, SLICE_MAINLOOP_URING_IO_USER_DATA(io, SLICE_MAINLOOP_URING_IO_SEND), NULL) != SLICE_RETURN_NORMAL) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    io->send_buffer->current = 0;
+    io->send_buffer->length = (unsigned int)total;
+    io->send_armed = 1;
+
+    return (ssize_t)total;
 }
 
-SliceReturnType slice_mainloop_epoll_event_remove_write(SliceMainloop *mainloop, int fd, char *err)
+// 1 while a completion socket still has staged bytes in flight, writes bypassing the staging buffer wait for them
+int slice_mainloop_epoll_event_send_busy(SliceMainloop *mainloop, int fd)
 {
     SliceMainloopEpollElement *element;
 
-    if (!mainloop || fd < 0 || fd > 0xffff) {
-        if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
+    if (!mainloop || !(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd)) || !element->uring_io) return 0;
+
+    return element->uring_io->send_armed;
+}
+
+// accept4(2) for fd, a completion listener hands out the socket its last request accepted, EAGAIN until the next one completes
+int slice_mainloop_epoll_event_accept(SliceMainloop *mainloop, int fd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+    SliceMainloopEpollElement *element;
+    SliceMainloopUringIO *io;
+    int sock;
+
+    if (!mainloop || !(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd)) || !(io = element->uring_io)) {
+        return accept4(fd, addr, addrlen, flags);
     }
 
-    if (fd >= mainloop->epoll->max_fd) {
-        if (err) sprintf(err, "FD [%d] table exceed, max [%d]", fd, mainloop->epoll->max_fd - 1);
-        return SLICE_RETURN_ERROR;
+    slice_mainloop_epoll_event_mark(mainloop, element, fd);
+
+    if (io->accept_error) {
+        errno = io->accept_error;
+        io->accept_error = 0;
+        return -1;
     }
 
-    element = &(mainloop->epoll->element_table[fd]);
+    if ((sock = io->accept_fd) < 0) {
+        errno = EAGAIN;
+        return -1;
+    }
 
-    if (element->need_write) {
-        element->need_write = 0;
-        return slice_mainloop_epoll_event_update(mainloop, fd, err);
+    io->accept_fd = -1;
+
+    if (addr && addrlen) {
+        if (*addrlen > io->accept_addrlen) *addrlen = io->accept_addrlen;
+        memcpy(addr, &(io->accept_addr), *addrlen);
     }
 
-    return SLICE_RETURN_NORMAL;
+    return sock;
 }
 
-SliceReturnType slice_mainloop_epoll_event_remove(SliceMainloop *mainloop, int fd, char *err)
+// reads, writes and accepts of fd complete through io_uring requests instead of readiness polls, INFO when the loop runs on epoll
+SliceReturnType slice_mainloop_epoll_event_set_completion(SliceMainloop *mainloop, int fd, int listen, char *err)
 {
     SliceMainloopEpollElement *element;
+    SliceMainloopUringIO *io;
 
-    if (!mainloop || fd < 0 || fd > 0xffff) {
+    if (!mainloop || fd < 0) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    if (fd >= mainloop->epoll->max_fd) {
-        if (err) sprintf(err, "FD [%d] table exceed, max [%d]", fd, mainloop->epoll->max_fd - 1);
+    if (mainloop->epoll->engine != SLICE_MAINLOOP_ENGINE_IO_URING) return SLICE_RETURN_INFO;
+
+    if (!(element = slice_mainloop_epoll_get_event_element(mainloop, fd, err))) return SLICE_RETURN_ERROR;
+
+    if (element->uring_io) return SLICE_RETURN_NORMAL;
+
+    if (!(io = (SliceMainloopUringIO*)malloc(sizeof(SliceMainloopUringIO)))) {
+        if (err) sprintf(err, "Can't allocate completion memory");
         return SLICE_RETURN_ERROR;
     }
 
-    element = &(mainloop->epoll->element_table[fd]);
+    memset(io, 0, sizeof(SliceMainloopUringIO));
 
-    if (element->fd >= 0) {
-        if (epoll_ctl(mainloop->epoll->epoll_fd, EPOLL_CTL_DEL, element->fd, NULL) < 0) {
-            if (err) sprintf(err, "epoll_ctl return error [%s]", strerror(errno));
-            return SLICE_RETURN_ERROR;
-        }
+    io->element = element;
+    io->fd = fd;
+    io->listen = listen;
+    io->accept_fd = -1;
 
-        memset(element, 0, sizeof(SliceMainloopEpollElement));
-        element->fd = -1;
-    }
+    element->uring_io = io;
+
+    // a poll armed for reading is dropped by the flush
+    slice_mainloop_epoll_event_mark(mainloop, element, fd);
 
     return SLICE_RETURN_NORMAL;
 }
-/*
-static int slice_mainloop_event_process_callback(SliceMainloopEpoll *epoll, SliceMainloopEpollElement *element, struct epoll_event event, void *user_data)
+
+static SliceReturnType slice_mainloop_uring_event_update(SliceMainloop *mainloop, SliceMainloopEpollElement *element, int fd, uint32_t flags, char *err)
 {
-    SliceMainloopEvent *slice_event = (SliceMainloopEvent*)user_data;
-    int r;
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    if (slice_event && slice_event->process_mainloop_cb) {
-        if ((r = slice_event->process_mainloop_cb(slice_event->mainloop, slice_event, err_buff)) < SLICE_RETURN_NORMAL) {
-            // skipp error buffer
+    // reads and accepts are requests, a writer polls only for sendfile and splice, a send in flight wakes it by completing
+    if (element->uring_io) flags = (flags & EPOLLOUT && !element->uring_io->send_armed) ? EPOLLOUT : 0;
+
+    // one-shot poll still armed with the same interest
+    if (element->fd == fd && element->uring_armed == flags) return (element->uring_io) ? slice_mainloop_uring_io_arm(mainloop, element, err) : SLICE_RETURN_NORMAL;
+
+    if (element->fd == fd && element->uring_armed) {
+        if (SliceUringPollRemove(mainloop->epoll->uring, SLICE_MAINLOOP_URING_USER_DATA(fd, element->uring_seq), err_buff) != SLICE_RETURN_NORMAL) {
+            if (err) sprintf(err, "SliceUringPollRemove return error [%s]", err_buff);
+            return SLICE_RETURN_ERROR;
         }
 
-        return r;
+        element->uring_armed = 0;
     }
 
-    return SLICE_RETURN_NORMAL;
-}
-*/
-SliceReturnType slice_mainloop_event_add(SliceMainloop *mainloop, SliceMainloopEvent *mainloop_event, SliceReturnType(*event_add_cb)(SliceMainloopEvent*, char*), SliceReturnType(*event_remove_cb)(SliceMainloopEvent*, char*), char *err)
-{
-    SliceMainloopEpollElement *element;
+    element->fd = fd;
 
-    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+    if (flags) {
+        element->uring_seq++;
 
-    if (!mainloop || !mainloop_event || !event_add_cb || !event_remove_cb) {
-        if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
-    }
+        if (SliceUringPollAdd(mainloop->epoll->uring, fd, flags, SLICE_MAINLOOP_URING_USER_DATA(fd, element->uring_seq), err_buff) != SLICE_RETURN_NORMAL) {
+            if (err) sprintf(err, "SliceUringPollAdd return error [%s]", err_buff);
+            return SLICE_RETURN_ERROR;
+        }
+
+        element->uring_armed = flags;
+    }
+
+    if (element->uring_io) return slice_mainloop_uring_io_arm(mainloop, element, err);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_epoll_event_update(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+    uint32_t flags = 0;
+    struct epoll_event ev;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // fd never seen by this loop, nothing registered
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd))) return SLICE_RETURN_NORMAL;
+
+    if (element->need_read) flags |= EPOLLIN;
+    if (element->need_write) flags |= EPOLLOUT;
+
+    // polls are one-shot and re-armed after dispatch, no edge trigger needed
+    if (mainloop->epoll->engine == SLICE_MAINLOOP_ENGINE_IO_URING) {
+        return slice_mainloop_uring_event_update(mainloop, element, fd, flags, err);
+    }
+
+    if (flags) flags |= EPOLLET;
+
+    //printf("Update [%d][%d]\n", element->need_read, element->need_write);
+
+    if (element->fd == fd && element->events == flags && !element->rearm) return SLICE_RETURN_NORMAL;
+
+    // nothing to register yet
+    if (element->fd != fd && !flags) return SLICE_RETURN_NORMAL;
+
+    element->rearm = 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    ev.events = flags;
+
+    if (element->fd == fd) {
+        if (epoll_ctl(mainloop->epoll->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            if (err) sprintf(err, "epoll_ctl return error [%s]", strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+    } else {
+        if (epoll_ctl(mainloop->epoll->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            if (err) sprintf(err, "epoll_ctl return error [%s]", strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+    }
+
+    element->fd = fd;
+    element->events = flags;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// record an interest change, applied by slice_mainloop_epoll_event_flush before the next wait
+static void slice_mainloop_epoll_event_mark(SliceMainloop *mainloop, SliceMainloopEpollElement *element, int fd)
+{
+    element->dirty_fd = fd;
+
+    if (element->dirty) return;
+
+    element->dirty = 1;
+    element->dirty_next = mainloop->epoll->dirty_list;
+    mainloop->epoll->dirty_list = element;
+}
+
+static void slice_mainloop_epoll_event_flush(SliceMainloop *mainloop)
+{
+    SliceMainloopEpollElement *element;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    while ((element = mainloop->epoll->dirty_list)) {
+        mainloop->epoll->dirty_list = element->dirty_next;
+        element->dirty_next = NULL;
+        element->dirty = 0;
+
+        if (slice_mainloop_epoll_event_update(mainloop, element->dirty_fd, err_buff) != SLICE_RETURN_NORMAL) {
+            printf("FD [%d] interest update return error [%s]\n", element->dirty_fd, err_buff);
+        }
+    }
+}
+
+// readiness may remain after a partial read, have the engine report the fd again
+SliceReturnType slice_mainloop_epoll_event_rearm(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_get_event_element(mainloop, fd, err))) return SLICE_RETURN_ERROR;
+
+    element->rearm = 1;
+    slice_mainloop_epoll_event_mark(mainloop, element, fd);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// queue the read callback for the next iteration, for data a read budget left in the socket
+SliceReturnType slice_mainloop_epoll_event_ready(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd)) || element->fd != fd) {
+        if (err) sprintf(err, "FD [%d] is not registered", fd);
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (element->ready) return SLICE_RETURN_NORMAL;
+
+    element->ready = 1;
+    element->ready_next = mainloop->epoll->ready_list;
+    mainloop->epoll->ready_list = element;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// queue the write callback for the flush pass, EPOLLOUT is only armed when the socket can't take it all
+SliceReturnType slice_mainloop_epoll_event_flush_write(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd)) || element->fd != fd) {
+        if (err) sprintf(err, "FD [%d] is not registered", fd);
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (element->flush) return SLICE_RETURN_NORMAL;
+
+    element->flush = 1;
+    element->flush_next = mainloop->epoll->flush_list;
+    mainloop->epoll->flush_list = element;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_epoll_event_add_read(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_get_event_element(mainloop, fd, err))) return SLICE_RETURN_ERROR;
+
+    if (!element->need_read) {
+        element->need_read = 1;
+        slice_mainloop_epoll_event_mark(mainloop, element, fd);
+    }
+    
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_epoll_event_add_write(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_get_event_element(mainloop, fd, err))) return SLICE_RETURN_ERROR;
+
+    if (!element->need_write) {
+        element->need_write = 1;
+        slice_mainloop_epoll_event_mark(mainloop, element, fd);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_epoll_event_remove_read(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // fd never seen by this loop, nothing registered
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd))) return SLICE_RETURN_NORMAL;
+
+    if (element->need_read) {
+        element->need_read = 0;
+        slice_mainloop_epoll_event_mark(mainloop, element, fd);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_epoll_event_remove_write(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // fd never seen by this loop, nothing registered
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd))) return SLICE_RETURN_NORMAL;
+
+    if (element->need_write) {
+        element->need_write = 0;
+        slice_mainloop_epoll_event_mark(mainloop, element, fd);
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_epoll_event_remove(SliceMainloop *mainloop, int fd, char *err)
+{
+    SliceMainloopEpollElement *element, *dirty_next, *ready_next, *flush_next;
+    SliceReturnType submit = SLICE_RETURN_NORMAL;
+    unsigned int uring_seq;
+    int dirty, dirty_fd, ready, flush;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!mainloop || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // fd never seen by this loop, nothing registered
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd))) return SLICE_RETURN_NORMAL;
+
+    if (element->fd >= 0) {
+        if (mainloop->epoll->engine == SLICE_MAINLOOP_ENGINE_IO_URING) {
+            if (element->uring_armed && SliceUringPollRemove(mainloop->epoll->uring, SLICE_MAINLOOP_URING_USER_DATA(element->fd, element->uring_seq), err_buff) != SLICE_RETURN_NORMAL) {
+                if (err) sprintf(err, "SliceUringPollRemove return error [%s]", err_buff);
+                return SLICE_RETURN_ERROR;
+            }
+        } else if (epoll_ctl(mainloop->epoll->epoll_fd, EPOLL_CTL_DEL, element->fd, NULL) < 0) {
+            if (err) sprintf(err, "epoll_ctl return error [%s]", strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+    }
+
+    if (element->uring_io) slice_mainloop_uring_io_detach(mainloop, element->uring_io);
+
+    // requests naming fd reach the kernel while it is still open, its number may be reused right after
+    if (mainloop->epoll->engine == SLICE_MAINLOOP_ENGINE_IO_URING) submit = SliceUringSubmit(mainloop->epoll->uring, err_buff);
+
+    // an add not flushed yet drops its interest and callbacks too, the next owner of fd starts clean
+
+    // keep the sequence so completions of the previous owner stay stale
+    uring_seq = element->uring_seq;
+
+    // still linked in the dirty list, the flush finds nothing to register
+    dirty = element->dirty;
+    dirty_fd = element->dirty_fd;
+    dirty_next = element->dirty_next;
+    ready = element->ready;
+    ready_next = element->ready_next;
+    flush = element->flush;
+    flush_next = element->flush_next;
+
+    memset(element, 0, sizeof(SliceMainloopEpollElement));
+    element->fd = -1;
+    element->uring_seq = uring_seq;
+    element->dirty = dirty;
+    element->dirty_fd = dirty_fd;
+    element->dirty_next = dirty_next;
+    element->ready = ready;
+    element->ready_next = ready_next;
+    element->flush = flush;
+    element->flush_next = flush_next;
+
+    if (submit == SLICE_RETURN_ERROR) {
+        if (err) sprintf(err, "SliceUringSubmit return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// readiness of watch_fd runs the write callback of fd, for a write waiting on its source instead of the socket
+SliceReturnType slice_mainloop_epoll_event_watch(SliceMainloop *mainloop, int fd, int watch_fd, char *err)
+{
+    SliceMainloopEpollElement *element, *watch;
+
+    if (!mainloop || fd < 0 || watch_fd < 0 || fd == watch_fd) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd)) || element->fd != fd || !element->write_cb) {
+        if (err) sprintf(err, "FD [%d] is not registered", fd);
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(watch = slice_mainloop_epoll_get_event_element(mainloop, watch_fd, err))) return SLICE_RETURN_ERROR;
+
+    // a source at its end only reports hang up, that goes to the write callback too
+    watch->slice_event = element->slice_event;
+    watch->read_cb = element->write_cb;
+    watch->close_cb = element->write_cb;
+
+    return slice_mainloop_epoll_event_add_read(mainloop, watch_fd, err);
+}
+
+// drop a watch before its fd is closed, also when the interest was never flushed to the engine
+SliceReturnType slice_mainloop_epoll_event_unwatch(SliceMainloop *mainloop, int watch_fd, char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    if (!mainloop || watch_fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, watch_fd))) return SLICE_RETURN_NORMAL;
+
+    slice_mainloop_epoll_event_remove_read(mainloop, watch_fd, NULL);
+
+    element->slice_event = NULL;
+    element->read_cb = NULL;
+    element->close_cb = NULL;
+
+    return slice_mainloop_epoll_event_remove(mainloop, watch_fd, err);
+}
+/*
+static int slice_mainloop_event_process_callback(SliceMainloopEpoll *epoll, SliceMainloopEpollElement *element, struct epoll_event event, void *user_data)
+{
+    SliceMainloopEvent *slice_event = (SliceMainloopEvent*)user_data;
+    int r;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (slice_event && slice_event->process_mainloop_cb) {
+        if ((r = slice_event->process_mainloop_cb(slice_event->mainloop, slice_event, err_buff)) < SLICE_RETURN_NORMAL) {
+            // skipp error buffer
+        }
+
+        return r;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+*/
+SliceReturnType slice_mainloop_event_add(SliceMainloop *mainloop, SliceMainloopEvent *mainloop_event, SliceReturnType(*event_add_cb)(SliceMainloopEvent*, char*), SliceReturnType(*event_remove_cb)(SliceMainloopEvent*, char*), char *err)
+{
+    SliceMainloopEpollElement *element;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!mainloop || !mainloop_event || !event_add_cb || !event_remove_cb) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    //if (!event->process_mainloop_cb) {
+    //    if (err) sprintf(err, "Can't add mainloop event [%s] without main process callback", event->name);
+    //    return SLICE_RETURN_ERROR;
+    //}
+
+    if (mainloop_event->io.fd < 0) {
+        if (err) sprintf(err, "Event io is not open/initialize");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(element = slice_mainloop_epoll_get_event_element(mainloop, mainloop_event->io.fd, err_buff))) {
+        if (err) sprintf(err, "slice_mainloop_epoll_get_event_element return [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (mainloop_event->io.obj.next || mainloop_event->io.obj.prev) {
+        if (err) sprintf(err, "Event is already added");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // add to epoll
+    //if (slice_mainloop_epoll_event_add_read(mainloop, event->io.fd, err_buff) != SLICE_RETURN_NORMAL) {
+    //    if (err) sprintf(err, "Add mainloop event to epoll return error [%s]", err_buff);
+    //    return SLICE_RETURN_ERROR;
+    //}
+
+    //slice_mainloop_epoll_set_callback(mainloop, event->io.fd, SLICE_MAINLOOP_EPOLL_EVENT_READ, (void*)slice_mainloop_event_process_callback, NULL);
+
+    element->slice_event = mainloop_event;
+    mainloop_event->mainloop = mainloop;
+
+    if (event_add_cb && event_add_cb(mainloop_event, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "Add event callback is return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    mainloop_event->remove_cb = event_remove_cb;
+
+    SliceListAppend(&(mainloop->event_list), mainloop_event, NULL);
+    mainloop->event_list_count++;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_event_remove(SliceMainloop *mainloop, SliceMainloopEvent *mainloop_event, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!mainloop || !mainloop_event) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // the event links tell membership, no list walk; already removed events are ignored
+    if (mainloop_event->mainloop != mainloop || !mainloop_event->io.obj.next) return SLICE_RETURN_NORMAL;
+
+    // remove from epoll, a failure leaves the event attached
+    if (slice_mainloop_epoll_event_remove(mainloop, mainloop_event->io.fd, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "slice_mainloop_epoll_event_remove return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    SliceListRemove(&(mainloop->event_list), mainloop_event, NULL);
+    mainloop->event_list_count--;
+
+    if (mainloop_event->remove_cb && mainloop_event->remove_cb(mainloop_event, err) != SLICE_RETURN_NORMAL) {
+        return SLICE_RETURN_ERROR;
+    }
+
+    mainloop_event->mainloop = NULL;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_set_user_data(SliceMainloop *mainloop, void *user_data, char *err)
+{
+    if (!mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    mainloop->user_data = user_data;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_set_callback(SliceMainloop *mainloop, SliceMainloopCallbackEvent event_num, int(*ev_callback)(SliceMainloop*, void*, char*), char *err)
+{
+    if (!mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    switch (event_num) {
+        case SLICE_MAINLOOP_EVENT_INIT:
+            mainloop->init_mainloop_cb = ev_callback;
+            break;
+
+        case SLICE_MAINLOOP_EVENT_PRELOOP:
+            mainloop->pre_loop_cb = ev_callback;
+            break;
+
+        case SLICE_MAINLOOP_EVENT_PROCESS:
+            mainloop->process_cb = ev_callback;
+            break;
+
+        case SLICE_MAINLOOP_EVENT_POSTLOOP:
+            mainloop->post_loop_cb = ev_callback;
+            break;
+
+        case SLICE_MAINLOOP_EVENT_FINISH:
+            mainloop->finish_mainloop_cb = ev_callback;
+            break;
+
+        default:
+            if (err) sprintf(err, "Invalis event number [%d]", (int)event_num);
+            return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_set_engine(SliceMainloop *mainloop, SliceMainloopEngine engine, char *err)
+{
+    SliceUring *uring;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (mainloop->epoll->engine == engine) return SLICE_RETURN_NORMAL;
+
+    if (mainloop->event_list_count > 0) {
+        if (err) sprintf(err, "Can't change engine while [%d] events are registered", mainloop->event_list_count);
+        return SLICE_RETURN_ERROR;
+    }
+
+    switch (engine) {
+        case SLICE_MAINLOOP_ENGINE_EPOLL:
+            if (mainloop->epoll->uring) {
+                SliceUringDestroy(mainloop->epoll->uring, NULL);
+                mainloop->epoll->uring = NULL;
+            }
+            break;
+
+        case SLICE_MAINLOOP_ENGINE_IO_URING:
+            // on failure the loop keeps running on epoll
+            if (!(uring = SliceUringCreate(SLICE_URING_DEFAULT_ENTRIES, err_buff))) {
+                if (err) sprintf(err, "SliceUringCreate return error [%s]", err_buff);
+                return SLICE_RETURN_ERROR;
+            }
+
+            mainloop->epoll->uring = uring;
+            break;
+
+        default:
+            if (err) sprintf(err, "Invalid engine [%d]", (int)engine);
+            return SLICE_RETURN_ERROR;
+    }
+
+    mainloop->epoll->engine = engine;
+
+    // wakeup fd is not an event, register it on the new engine
+    if (slice_mainloop_epoll_event_update(mainloop, mainloop->wakeup_fd, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "Register wakeup fd return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
 
-    if (mainloop->event_list_count >= SLICE_MAINLOOP_MAX_EVENT) {
-        if (err) sprintf(err, "Event is full");
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceMainloopEngine slice_mainloop_get_engine(SliceMainloop *mainloop)
+{
+    if (!mainloop) return SLICE_MAINLOOP_ENGINE_EPOLL;
+
+    return mainloop->epoll->engine;
+}
+
+SliceReturnType slice_mainloop_timer_start(SliceMainloop *mainloop, SliceTimer *timer, unsigned int timeout, unsigned int interval, char *err)
+{
+    if (!mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    //if (!event->process_mainloop_cb) {
-    //    if (err) sprintf(err, "Can't add mainloop event [%s] without main process callback", event->name);
-    //    return SLICE_RETURN_ERROR;
-    //}
+    return SliceTimerWheelStart(mainloop->timer_wheel, timer, timeout, interval, err);
+}
 
-    if (mainloop_event->io.fd < 0 || mainloop_event->io.fd > 0xffff) {
-        if (err) sprintf(err, "Event io is not open/initialize");
+SliceReturnType slice_mainloop_timer_stop(SliceMainloop *mainloop, SliceTimer *timer, char *err)
+{
+    if (!mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    if (!(element = slice_mainloop_epoll_get_event_element(mainloop, mainloop_event->io.fd, err_buff))) {
-        if (err) sprintf(err, "slice_mainloop_epoll_get_event_element return [%s]", err_buff);
+    return SliceTimerWheelStop(mainloop->timer_wheel, timer, err);
+}
+
+SliceTimerWheel *slice_mainloop_get_timer_wheel(SliceMainloop *mainloop)
+{
+    if (!mainloop) return NULL;
+
+    return mainloop->timer_wheel;
+}
+
+SliceReturnType slice_mainloop_set_busy_poll(SliceMainloop *mainloop, unsigned int budget, char *err)
+{
+    if (!mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    // add to epoll
-    //if (slice_mainloop_epoll_event_add_read(mainloop, event->io.fd, err_buff) != SLICE_RETURN_NORMAL) {
-    //    if (err) sprintf(err, "Add mainloop event to epoll return error [%s]", err_buff);
-    //    return SLICE_RETURN_ERROR;
-    //}
+    mainloop->busy_poll_budget = budget;
+    mainloop->busy_poll_spin = budget;
 
-    //slice_mainloop_epoll_set_callback(mainloop, event->io.fd, SLICE_MAINLOOP_EPOLL_EVENT_READ, (void*)slice_mainloop_event_process_callback, NULL);
+    return SLICE_RETURN_NORMAL;
+}
 
-    element->slice_event = mainloop_event;
-    mainloop_event->mainloop = mainloop;
+unsigned int slice_mainloop_get_busy_poll(SliceMainloop *mainloop)
+{
+    if (!mainloop) return 0;
 
-    if (event_add_cb && event_add_cb(mainloop_event, err_buff) != SLICE_RETURN_NORMAL) {
-        if (err) sprintf(err, "Add event callback is return error [%s]", err_buff);
+    return mainloop->busy_poll_budget;
+}
+
+static unsigned long long slice_mainloop_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((unsigned long long)ts.tv_sec * 1000000000ULL) + (unsigned long long)ts.tv_nsec;
+}
+
+static void slice_mainloop_histogram_add(SliceMainloopHistogram *histogram, unsigned long long value)
+{
+    int index = (value) ? 64 - __builtin_clzll(value) : 0;
+
+    if (index >= SLICE_MAINLOOP_HISTOGRAM_SIZE) index = SLICE_MAINLOOP_HISTOGRAM_SIZE - 1;
+
+    histogram->bucket[index]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) histogram->max = value;
+}
+
+// upper bound of the bucket holding the percentile, exact enough to tell kernel, TLS and callback time apart
+unsigned long long slice_mainloop_histogram_percentile(SliceMainloopHistogram *histogram, double percentile)
+{
+    unsigned long long rank, seen = 0;
+    int i;
+
+    if (!histogram || histogram->count == 0) return 0;
+
+    if (percentile >= 100.0) return histogram->max;
+
+    rank = (unsigned long long)((double)histogram->count * percentile / 100.0);
+    if (rank == 0) rank = 1;
+
+    for (i = 0; i < SLICE_MAINLOOP_HISTOGRAM_SIZE - 1; i++) {
+        if ((seen += histogram->bucket[i]) >= rank) {
+            return (i == 0) ? 0 : (((1ULL << i) - 1 < histogram->max) ? (1ULL << i) - 1 : histogram->max);
+        }
+    }
+
+    return histogram->max;
+}
+
+// stats are kept by the loop thread, disabled loops only pay a NULL check per step
+SliceReturnType slice_mainloop_set_stats(SliceMainloop *mainloop, int enable, char *err)
+{
+    if (!mainloop) {
+        if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    mainloop_event->remove_cb = event_remove_cb;
+    if (enable && !mainloop->stats) {
+        if (!(mainloop->stats = (SliceMainloopStats*)calloc(1, sizeof(SliceMainloopStats)))) {
+            if (err) sprintf(err, "Can't allocate mainloop stats memory");
+            return SLICE_RETURN_ERROR;
+        }
+    }
 
-    SliceListAppend(&(mainloop->event_list), mainloop_event, NULL);
-    mainloop->event_list_count++;
+    mainloop->stats_enabled = (enable) ? 1 : 0;
 
     return SLICE_RETURN_NORMAL;
 }
 
-SliceReturnType slice_mainloop_event_remove(SliceMainloop *mainloop, SliceMainloopEvent *mainloop_event, char *err)
+// consistent only on the loop thread, other threads should take it through SliceMainloopPost
+SliceReturnType slice_mainloop_get_stats(SliceMainloop *mainloop, SliceMainloopStats *stats, char *err)
 {
-    SliceMainloopEvent *tmp;
-    SliceMainloopEpollElement *element;
+    if (!mainloop || !stats) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
 
-    if (!mainloop || !mainloop_event) {
+    if (!mainloop->stats) {
+        if (err) sprintf(err, "Mainloop stats were never enabled");
+        return SLICE_RETURN_ERROR;
+    }
+
+    memcpy(stats, mainloop->stats, sizeof(SliceMainloopStats));
+
+    stats->write_queued = mainloop->write_queued;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_mainloop_reset_stats(SliceMainloop *mainloop, char *err)
+{
+    if (!mainloop) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    if ((tmp = mainloop->event_list)) {
-        do {
-            if (tmp == mainloop_event) {
-                SliceListRemove(&(mainloop->event_list), mainloop_event, NULL);
-                mainloop->event_list_count--;
+    if (mainloop->stats) memset(mainloop->stats, 0, sizeof(SliceMainloopStats));
 
-                // remove from epoll
-                if ((element = slice_mainloop_epoll_get_event_element(mainloop, mainloop_event->io.fd, NULL))) {
-                    element->slice_event = NULL;
-                }
-                slice_mainloop_epoll_event_remove(mainloop, mainloop_event->io.fd, NULL);
+    return SLICE_RETURN_NORMAL;
+}
 
-                if (mainloop_event->remove_cb && mainloop_event->remove_cb(mainloop_event, err) != SLICE_RETURN_NORMAL) {
-                    return SLICE_RETURN_ERROR;
-                }
+// configured timeout capped by the nearest timer, a negative configured timeout waits for the timer only
+static int slice_mainloop_get_wait_timeout(SliceMainloop *mainloop)
+{
+    int timeout = mainloop->epoll->timeout, timer_timeout;
+
+    // queued reads must not wait behind a blocking wait
+    if (mainloop->epoll->ready_list || mainloop->epoll->flush_list) return 0;
+
+    if ((timer_timeout = SliceTimerWheelNextTimeout(mainloop->timer_wheel, SliceTimerNow())) < 0) return timeout;
+
+    if (timeout < 0 || timer_timeout < timeout) return timer_timeout;
+
+    return timeout;
+}
+
+static int slice_mainloop_wait(SliceMainloop *mainloop, struct epoll_event *event_bucket, int timeout, char *err)
+{
+    SliceMainloopEpollElement *element;
+    int event_count, i, fd;
+    unsigned int seq;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (mainloop->epoll->engine != SLICE_MAINLOOP_ENGINE_IO_URING) {
+        if ((event_count = epoll_wait(mainloop->epoll->epoll_fd, event_bucket, mainloop->epoll->max_fetch_event, timeout)) < 0) {
+            if (err) sprintf(err, "epoll_wait return error [%s]", strerror(errno));
+            return -1;
+        }
+
+        return event_count;
+    }
+
+    // queued poll changes are submitted by the same system call
+    if ((event_count = SliceUringWait(mainloop->epoll->uring, event_bucket, mainloop->epoll->max_fetch_event, timeout, err_buff)) < 0) {
+        if (err) sprintf(err, "SliceUringWait return error [%s]", err_buff);
+        return -1;
+    }
+
+    for (i = 0; i < event_count; i++) {
+        if (event_bucket[i].data.u64 & SLICE_URING_USER_DATA_IO) {
+            slice_mainloop_uring_io_complete(mainloop, &(event_bucket[i]));
+            continue;
+        }
+
+        fd = (int)(event_bucket[i].data.u64 & 0xffffffffULL);
+        seq = (unsigned int)(event_bucket[i].data.u64 >> 32);
+
+        event_bucket[i].data.u64 = 0;
+        event_bucket[i].data.fd = -1;
+
+        if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, fd))) continue;
+
+        if (element->fd != fd || (element->uring_seq & SLICE_MAINLOOP_URING_SEQ_MASK) != seq) continue;
+
+        // one-shot poll consumed, re-armed by the next flush
+        element->uring_armed = 0;
+        slice_mainloop_epoll_event_mark(mainloop, element, fd);
+        event_bucket[i].data.fd = fd;
+    }
+
+    return event_count;
+}
+
+// spin on zero timeout waits for up to the current window, returns 0 when nothing arrived
+static int slice_mainloop_busy_poll(SliceMainloop *mainloop, struct epoll_event *event_bucket, int timeout, char *err)
+{
+    unsigned long long start, window;
+    int event_count;
+
+    if (!mainloop->busy_poll_budget || timeout == 0) return 0;
+
+    window = mainloop->busy_poll_spin;
+
+    // never spin past the nearest timer
+    if (timeout > 0 && window > (unsigned long long)timeout * 1000ULL) window = (unsigned long long)timeout * 1000ULL;
 
-                mainloop_event->mainloop = NULL;
+    start = slice_mainloop_now_ns() / 1000ULL;
 
-                return SLICE_RETURN_NORMAL;
+    do {
+        if ((event_count = slice_mainloop_wait(mainloop, event_bucket, 0, err)) != 0) {
+            // events keep arriving inside the window, spinning pays off so widen it
+            if (event_count > 0) {
+                mainloop->busy_poll_spin = (mainloop->busy_poll_spin > mainloop->busy_poll_budget / 2) ? mainloop->busy_poll_budget : mainloop->busy_poll_spin * 2;
             }
 
-            tmp = (SliceMainloopEvent*)tmp->io.obj.next;
-        } while(tmp != mainloop->event_list);
+            return event_count;
+        }
+    } while (slice_mainloop_now_ns() / 1000ULL - start < window);
+
+    // quiet loop, burn less before blocking next time
+    mainloop->busy_poll_spin /= 2;
+    if (mainloop->busy_poll_spin < SLICE_MAINLOOP_BUSY_POLL_MIN_SPIN) {
+        mainloop->busy_poll_spin = (mainloop->busy_poll_budget < SLICE_MAINLOOP_BUSY_POLL_MIN_SPIN) ? mainloop->busy_poll_budget : SLICE_MAINLOOP_BUSY_POLL_MIN_SPIN;
     }
 
-    return SLICE_RETURN_NORMAL;
+    return 0;
 }
 
-SliceReturnType slice_mainloop_set_user_data(SliceMainloop *mainloop, void *user_data, char *err)
+static void slice_mainloop_wakeup(SliceMainloop *mainloop)
 {
-    if (!mainloop) {
+    uint64_t value = 1;
+
+    // a full counter already guarantees a wakeup
+    if (write(mainloop->wakeup_fd, &value, sizeof(value)) < 0) return;
+}
+
+SliceReturnType slice_mainloop_post(SliceMainloop *mainloop, void(*callback)(SliceMainloop*, void*), void *arg, char *err)
+{
+    SliceMainloopTask *task, *head;
+
+    if (!mainloop || !callback) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    mainloop->user_data = user_data;
+    if (!(task = (SliceMainloopTask*)malloc(sizeof(SliceMainloopTask)))) {
+        if (err) sprintf(err, "Can't allocate mainloop task memory");
+        return SLICE_RETURN_ERROR;
+    }
+
+    task->callback = callback;
+    task->arg = arg;
+
+    head = __atomic_load_n(&(mainloop->task_list), __ATOMIC_RELAXED);
+
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(&(mainloop->task_list), &head, task, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // only the post that finds the list empty has to wake the loop
+    if (!head) slice_mainloop_wakeup(mainloop);
 
     return SLICE_RETURN_NORMAL;
 }
 
-SliceReturnType slice_mainloop_set_callback(SliceMainloop *mainloop, SliceMainloopCallbackEvent event_num, int(*ev_callback)(SliceMainloop*, void*, char*), char *err)
+static int slice_mainloop_run_tasks(SliceMainloop *mainloop)
 {
-    if (!mainloop) {
-        if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
+    SliceMainloopTask *task, *next, *list = NULL;
+    uint64_t value;
+    int count = 0;
+
+    if (read(mainloop->wakeup_fd, &value, sizeof(value)) < 0) {
+        // EAGAIN, counter already consumed
     }
 
-    switch (event_num) {
-        case SLICE_MAINLOOP_EVENT_INIT:
-            mainloop->init_mainloop_cb = ev_callback;
-            break;
+    task = __atomic_exchange_n(&(mainloop->task_list), NULL, __ATOMIC_ACQUIRE);
 
-        case SLICE_MAINLOOP_EVENT_PRELOOP:
-            mainloop->pre_loop_cb = ev_callback;
-            break;
+    // pushed as a stack, reverse to run in post order
+    while (task) {
+        next = task->next;
+        task->next = list;
+        list = task;
+        task = next;
+    }
 
-        case SLICE_MAINLOOP_EVENT_PROCESS:
-            mainloop->process_cb = ev_callback;
-            break;
+    while ((task = list)) {
+        list = task->next;
+        task->callback(mainloop, task->arg);
+        free(task);
+        count++;
+    }
 
-        case SLICE_MAINLOOP_EVENT_POSTLOOP:
-            mainloop->post_loop_cb = ev_callback;
-            break;
+    return count;
+}
 
-        case SLICE_MAINLOOP_EVENT_FINISH:
-            mainloop->finish_mainloop_cb = ev_callback;
-            break;
+// reads queued by the previous iteration, ones queued while running wait for the next one
+static int slice_mainloop_run_ready(SliceMainloop *mainloop, SliceMainloopStats *stats)
+{
+    SliceMainloopEpollElement *element, *list;
+    struct epoll_event event;
+    unsigned long long start = 0;
+    int fd, count = 0;
 
-        default:
-            if (err) sprintf(err, "Invalis event number [%d]", (int)event_num);
-            return SLICE_RETURN_ERROR;
+    list = mainloop->epoll->ready_list;
+    mainloop->epoll->ready_list = NULL;
+
+    while ((element = list)) {
+        list = element->ready_next;
+        element->ready_next = NULL;
+        element->ready = 0;
+
+        // removed or paused since it was queued
+        if ((fd = element->fd) < 0 || !element->read_cb || !element->need_read) continue;
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+
+        // tagged before the callback, a remove inside it resets the tag with the element
+        element->ready_pass = mainloop->epoll->ready_pass;
+
+        if (stats) start = slice_mainloop_now_ns();
+
+        element->read_cb(mainloop->epoll, element, event, (void*)element->slice_event);
+
+        if (stats) slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_READ]), slice_mainloop_now_ns() - start);
+
+        count++;
     }
 
-    return SLICE_RETURN_NORMAL;
+    return count;
+}
+
+// output queued since the last wait, a write the socket takes whole never needs EPOLLOUT
+static int slice_mainloop_run_flush(SliceMainloop *mainloop, SliceMainloopStats *stats)
+{
+    SliceMainloopEpollElement *element, *list;
+    struct epoll_event event;
+    unsigned long long start = 0;
+    int fd, count = 0;
+
+    list = mainloop->epoll->flush_list;
+    mainloop->epoll->flush_list = NULL;
+
+    while ((element = list)) {
+        list = element->flush_next;
+        element->flush_next = NULL;
+        element->flush = 0;
+
+        // removed since it was queued
+        if ((fd = element->fd) < 0 || !element->write_cb) continue;
+
+        // EPOLLOUT already armed for a full socket, its edge does the write
+        if (element->need_write) continue;
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLOUT;
+        event.data.fd = fd;
+
+        if (stats) start = slice_mainloop_now_ns();
+
+        element->write_cb(mainloop->epoll, element, event, (void*)element->slice_event);
+
+        if (stats) slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_WRITE]), slice_mainloop_now_ns() - start);
+
+        count++;
+    }
+
+    return count;
 }
 
 SliceReturnType slice_mainloop_run(SliceMainloop *mainloop, char *err)
@@ -549,9 +1780,11 @@ SliceReturnType slice_mainloop_run(SliceMainloop *mainloop, char *err)
 
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    int event_count, i;
+    int event_count, timeout, busy_poll, count, i;
     struct epoll_event* event_bucket;
     SliceMainloopEpollElement *element;
+    SliceMainloopStats *stats;
+    unsigned long long start = 0, wake = 0;
     
     err_buff[0] = 0;
 
@@ -560,7 +1793,7 @@ SliceReturnType slice_mainloop_run(SliceMainloop *mainloop, char *err)
         return SLICE_RETURN_ERROR;
     }
 
-    mainloop->quit = 0;
+    __atomic_store_n(&(mainloop->quit), 0, __ATOMIC_RELEASE);
 
     event_bucket = mainloop->epoll->event_bucket;
 
@@ -574,7 +1807,13 @@ SliceReturnType slice_mainloop_run(SliceMainloop *mainloop, char *err)
 
     // external init
 
-    while (!mainloop->quit) {
+    while (!__atomic_load_n(&(mainloop->quit), __ATOMIC_ACQUIRE)) {
+        // may be switched by any callback, picked up per iteration
+        if ((stats = (mainloop->stats_enabled) ? mainloop->stats : NULL)) {
+            stats->iterations++;
+            start = slice_mainloop_now_ns();
+        }
+
         // main pre
         if (mainloop->pre_loop_cb) {
             if ((ret = mainloop->pre_loop_cb(mainloop, (void*)mainloop->user_data, err_buff)) != SLICE_RETURN_NORMAL) {
@@ -594,52 +1833,127 @@ SliceReturnType slice_mainloop_run(SliceMainloop *mainloop, char *err)
             }
         }
 
+        if (mainloop->epoll->flush_list) {
+            count = slice_mainloop_run_flush(mainloop, stats);
+            if (stats) stats->flushed_writes += count;
+        }
+
+        slice_mainloop_epoll_event_flush(mainloop);
+
+        if (stats) {
+            wake = slice_mainloop_now_ns();
+            if (mainloop->pre_loop_cb || mainloop->process_cb) slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_LOOP]), wake - start);
+            start = wake;
+        }
+
         // external epoll event
-        if ((event_count = epoll_wait(mainloop->epoll->epoll_fd, event_bucket, mainloop->epoll->max_fetch_event, mainloop->epoll->timeout)) < 0) {
-            if (err) sprintf(err, "epoll_wait return error [%s]", strerror(errno));
+        timeout = slice_mainloop_get_wait_timeout(mainloop);
+
+        if ((event_count = busy_poll = slice_mainloop_busy_poll(mainloop, event_bucket, timeout, err)) == 0) {
+            event_count = slice_mainloop_wait(mainloop, event_bucket, timeout, err);
+        }
+
+        if (event_count < 0) {
             return SLICE_RETURN_ERROR;
         }
 
+        if (stats) {
+            wake = slice_mainloop_now_ns();
+            slice_mainloop_histogram_add(&(stats->wait_ns), wake - start);
+
+            if (event_count > 0) {
+                stats->wakeups++;
+                stats->events += event_count;
+                if (busy_poll > 0) stats->busy_poll_hits++;
+                slice_mainloop_histogram_add(&(stats->events_per_wake), event_count);
+            }
+        }
+
+        // one read budget per element and iteration, whether it comes from the ready list or the batch
+        mainloop->epoll->ready_pass++;
+
+        if (mainloop->epoll->ready_list) {
+            count = slice_mainloop_run_ready(mainloop, stats);
+            if (stats) stats->ready_reads += count;
+        }
+
         for (i = 0; i < event_count; i++) {
-            if (event_bucket[i].data.fd < 0 || event_bucket[i].data.fd >= mainloop->epoll->max_fd) {
-                // FD table exceed
+            if (event_bucket[i].data.fd == mainloop->wakeup_fd) {
+                if (stats) start = slice_mainloop_now_ns();
+
+                count = slice_mainloop_run_tasks(mainloop);
+
+                if (stats) {
+                    stats->tasks_run += count;
+                    slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_TASK]), slice_mainloop_now_ns() - start);
+                }
                 continue;
             }
 
-            if (!(element = (SliceMainloopEpollElement*)&(mainloop->epoll->element_table[event_bucket[i].data.fd]))) {
+            if (!(element = slice_mainloop_epoll_lookup_element(mainloop->epoll, event_bucket[i].data.fd))) {
                 // Can't locate event FD
                 continue;
             }
 
-            if (event_bucket[i].events & EPOLLIN) {
-                if (element->read_cb && element->read_cb(mainloop->epoll, element, event_bucket[i], (void*)element->slice_event) != SLICE_RETURN_NORMAL) {
-                    continue;
-                }
+            // reads paused earlier in this batch wait for their resume, ones the ready list ran already had their turn
+            if (event_bucket[i].events & EPOLLIN && element->read_cb && element->need_read && element->ready_pass != mainloop->epoll->ready_pass) {
+                if (stats) start = slice_mainloop_now_ns();
+
+                ret = element->read_cb(mainloop->epoll, element, event_bucket[i], (void*)element->slice_event);
+
+                if (stats) slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_READ]), slice_mainloop_now_ns() - start);
+
+                if (ret != SLICE_RETURN_NORMAL) continue;
             }
             if (event_bucket[i].events & EPOLLOUT) {
                 slice_mainloop_epoll_event_remove_write(mainloop, event_bucket[i].data.fd, NULL);
 
-                if (element->write_cb && element->write_cb(mainloop->epoll, element, event_bucket[i], (void*)element->slice_event) != SLICE_RETURN_NORMAL) {
-                    continue;
+                if (element->write_cb) {
+                    if (stats) start = slice_mainloop_now_ns();
+
+                    ret = element->write_cb(mainloop->epoll, element, event_bucket[i], (void*)element->slice_event);
+
+                    if (stats) slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_WRITE]), slice_mainloop_now_ns() - start);
+
+                    if (ret != SLICE_RETURN_NORMAL) continue;
                 }
             }
             if (event_bucket[i].events & EPOLLERR || event_bucket[i].events & EPOLLHUP) {
                 if (element->close_cb) {
+                    if (stats) start = slice_mainloop_now_ns();
+
                     element->close_cb(mainloop->epoll, element, event_bucket[i], (void*)element->slice_event);
+
+                    if (stats) slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_CLOSE]), slice_mainloop_now_ns() - start);
                 }
             }
-            slice_mainloop_epoll_event_update(mainloop, event_bucket[i].data.fd, err);
+        }
+
+        // expired timers
+        if (stats) start = slice_mainloop_now_ns();
+
+        count = SliceTimerWheelAdvance(mainloop->timer_wheel, SliceTimerNow());
+
+        if (stats && count > 0) {
+            stats->timers_fired += count;
+            slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_TIMER]), slice_mainloop_now_ns() - start);
         }
 
         // main post
         if (mainloop->post_loop_cb) {
+            if (stats) start = slice_mainloop_now_ns();
+
             if ((ret = mainloop->post_loop_cb(mainloop, (void*)mainloop->user_data, err_buff)) != SLICE_RETURN_NORMAL) {
                 if (err) sprintf(err, "mainloop->post_loop_cb return [%d] [%s]", (int)ret, err_buff);
                 return ret;
             }
+
+            if (stats) slice_mainloop_histogram_add(&(stats->callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_LOOP]), slice_mainloop_now_ns() - start);
         }
 
         // external post
+
+        if (stats) slice_mainloop_histogram_add(&(stats->loop_lag_ns), slice_mainloop_now_ns() - wake);
     }
 
     // main finish
@@ -655,61 +1969,69 @@ SliceReturnType slice_mainloop_run(SliceMainloop *mainloop, char *err)
     return SLICE_RETURN_NORMAL;
 }
 
+// safe from any thread, the loop wakes up immediately
 void slice_mainloop_quit(SliceMainloop *mainloop)
 {
     if (!mainloop) return;
 
-    mainloop->quit = 1;
+    __atomic_store_n(&(mainloop->quit), 1, __ATOMIC_RELEASE);
+
+    slice_mainloop_wakeup(mainloop);
 }
 
-struct slice_buffer *slice_mainloop_get_buffer_bucket(SliceMainloop *mainloop)
+SliceBufferPool *slice_mainloop_get_buffer_pool(SliceMainloop *mainloop)
 {
     if (!mainloop) return NULL;
 
-    return mainloop->buffer_bucket;
+    return mainloop->buffer_pool;
+}
+
+// connections report their write queue growth and drain, delta is negative when bytes leave
+void slice_mainloop_account_write_queue(SliceMainloop *mainloop, long long delta)
+{
+    if (!mainloop) return;
+
+    if (delta < 0 && (unsigned long long)(-delta) > mainloop->write_queued) {
+        mainloop->write_queued = 0;
+    } else {
+        mainloop->write_queued += delta;
+    }
 }
 
-int slice_mainloop_get_buffer_bucket_count(SliceMainloop *mainloop)
+unsigned long long slice_mainloop_get_write_queued(SliceMainloop *mainloop)
 {
-    if (!mainloop) return -1;
+    if (!mainloop) return 0;
 
-    return mainloop->buffer_bucket_count;
+    return mainloop->write_queued;
 }
 
-SliceReturnType slice_mainloop_buffer_bucket_add(SliceMainloop *mainloop, SliceBuffer *buffer, char *err)
+// lent to one connection at a time, taken back before its read callback returns
+SliceBuffer *slice_mainloop_get_read_scratch(SliceMainloop *mainloop, char *err)
 {
-    if (!mainloop || !buffer) {
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!mainloop) {
         if (err) sprintf(err, "Invalid parameter");
-        return SLICE_RETURN_ERROR;
+        return NULL;
     }
 
-    if (buffer->obj.next || buffer->obj.prev) {
-        if (err) sprintf(err, "Buffer is may be exist in lists");
-        return SLICE_RETURN_ERROR;
+    if (!mainloop->read_scratch && !(mainloop->read_scratch = SliceBufferCreate(mainloop, SLICE_MAINLOOP_READ_SCRATCH_SIZE, err_buff))) {
+        if (err) sprintf(err, "SliceBufferCreate return error [%s]", err_buff);
+        return NULL;
     }
 
-    SliceListAppend(&(mainloop->buffer_bucket), buffer, NULL);
-    mainloop->buffer_bucket_count++;
-
-    return SLICE_RETURN_NORMAL;
+    return mainloop->read_scratch;
 }
 
-SliceReturnType slice_mainloop_buffer_bucket_remove(SliceMainloop *mainloop, SliceBuffer *buffer, char *err)
+// call right after create, before the loop hands out buffers, the whole size is faulted in here
+SliceReturnType slice_mainloop_set_buffer_arena(SliceMainloop *mainloop, unsigned long long size, char *err)
 {
-    if (!mainloop || !buffer) {
+    if (!mainloop) {
         if (err) sprintf(err, "Invalid parameter");
         return SLICE_RETURN_ERROR;
     }
 
-    if (!buffer->obj.next || !buffer->obj.prev) {
-        if (err) sprintf(err, "Buffer is may be not exist in lists");
-        return SLICE_RETURN_ERROR;
-    }
-
-    SliceListRemove(&(mainloop->buffer_bucket), buffer, NULL);
-    mainloop->buffer_bucket_count--;
-
-    return SLICE_RETURN_NORMAL;
+    return SliceBufferPoolSetArena(mainloop->buffer_pool, size, err);
 }
 
 SliceMainloopEvent *slice_mainloop_epoll_element_get_slice_mainloop_event(SliceMainloopEpollElement *mainloop_epoll_element)
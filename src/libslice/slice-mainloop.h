@@ -2,15 +2,19 @@
 #define _SLICE_MAINLOOP_H_
 
 #include <sys/epoll.h>
+#include <sys/socket.h>
 
 #include "slice-io.h"
 #include "slice-buffer.h"
-
-#define SLICE_MAINLOOP_MAX_EVENT            (63 * 1024)
+#include "slice-timer.h"
 
 typedef struct slice_mainloop SliceMainloop;
 typedef enum slice_mainloop_callback_event SliceMainloopCallbackEvent;
+typedef enum slice_mainloop_engine SliceMainloopEngine;
 typedef struct slice_mainloop_event SliceMainloopEvent;
+typedef enum slice_mainloop_stats_callback SliceMainloopStatsCallback;
+typedef struct slice_mainloop_histogram SliceMainloopHistogram;
+typedef struct slice_mainloop_stats SliceMainloopStats;
 
 typedef enum slice_mainloop_epoll_event_callback SliceMainloopEpollEventCallback;
 typedef struct slice_mainloop_epoll SliceMainloopEpoll;
@@ -18,6 +22,7 @@ typedef struct slice_mainloop_epoll_element SliceMainloopEpollElement;
 
 // loop struct definetion
 typedef struct slice_buffer SliceBuffer;
+typedef struct slice_buffer_pool SliceBufferPool;
 
 enum slice_mainloop_callback_event
 {
@@ -28,6 +33,12 @@ enum slice_mainloop_callback_event
     SLICE_MAINLOOP_EVENT_FINISH
 };
 
+enum slice_mainloop_engine
+{
+    SLICE_MAINLOOP_ENGINE_EPOLL = 0,
+    SLICE_MAINLOOP_ENGINE_IO_URING
+};
+
 enum slice_mainloop_epoll_event_callback
 {
     SLICE_MAINLOOP_EPOLL_EVENT_WRITE = 0,
@@ -35,6 +46,50 @@ enum slice_mainloop_epoll_event_callback
     SLICE_MAINLOOP_EPOLL_EVENT_CLOSE
 };
 
+// log2 buckets, bucket n counts values in [2^(n-1), 2^n), the last one takes everything above
+#define SLICE_MAINLOOP_HISTOGRAM_SIZE       40
+
+// one read buffer lent in turn to connections in scratch read mode, twice the default read budget
+#define SLICE_MAINLOOP_READ_SCRATCH_SIZE    (128 * 1024)
+
+enum slice_mainloop_stats_callback
+{
+    SLICE_MAINLOOP_STATS_CALLBACK_READ = 0,
+    SLICE_MAINLOOP_STATS_CALLBACK_WRITE,
+    SLICE_MAINLOOP_STATS_CALLBACK_CLOSE,
+    SLICE_MAINLOOP_STATS_CALLBACK_LOOP,     // pre, process and post loop callbacks
+    SLICE_MAINLOOP_STATS_CALLBACK_TIMER,
+    SLICE_MAINLOOP_STATS_CALLBACK_TASK,
+    SLICE_MAINLOOP_STATS_CALLBACK_COUNT
+};
+
+struct slice_mainloop_histogram
+{
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+
+    unsigned long long bucket[SLICE_MAINLOOP_HISTOGRAM_SIZE];
+};
+
+struct slice_mainloop_stats
+{
+    unsigned long long iterations;
+    unsigned long long wakeups;             // waits which returned events
+    unsigned long long events;
+    unsigned long long busy_poll_hits;      // wakeups found by spinning
+    unsigned long long timers_fired;
+    unsigned long long tasks_run;
+    unsigned long long ready_reads;         // reads resumed from the ready queue
+    unsigned long long flushed_writes;      // writes tried by the flush pass before waiting
+    unsigned long long write_queued;        // bytes in connection write queues when the stats were read
+
+    SliceMainloopHistogram events_per_wake;
+    SliceMainloopHistogram wait_ns;         // time spent spinning and blocked in the kernel
+    SliceMainloopHistogram loop_lag_ns;     // time from a wakeup until the loop waits again
+    SliceMainloopHistogram callback_ns[SLICE_MAINLOOP_STATS_CALLBACK_COUNT];
+};
+
 struct slice_mainloop_event
 {
     struct slice_io io;
@@ -70,12 +125,25 @@ SliceReturnType slice_mainloop_event_add(SliceMainloop *mainloop, SliceMainloopE
 SliceReturnType slice_mainloop_event_remove(SliceMainloop *mainloop, SliceMainloopEvent *mainloop_event, char *err);
 SliceReturnType slice_mainloop_set_user_data(SliceMainloop *mainloop, void *user_data, char *err);
 SliceReturnType slice_mainloop_set_callback(SliceMainloop *mainloop, SliceMainloopCallbackEvent event_num, int(*ev_callback)(SliceMainloop*, void*, char*), char *err);
+SliceReturnType slice_mainloop_set_engine(SliceMainloop *mainloop, SliceMainloopEngine engine, char *err);
+SliceMainloopEngine slice_mainloop_get_engine(SliceMainloop *mainloop);
+SliceReturnType slice_mainloop_timer_start(SliceMainloop *mainloop, SliceTimer *timer, unsigned int timeout, unsigned int interval, char *err);
+SliceReturnType slice_mainloop_timer_stop(SliceMainloop *mainloop, SliceTimer *timer, char *err);
+SliceTimerWheel *slice_mainloop_get_timer_wheel(SliceMainloop *mainloop);
+SliceReturnType slice_mainloop_set_busy_poll(SliceMainloop *mainloop, unsigned int budget, char *err);
+unsigned int slice_mainloop_get_busy_poll(SliceMainloop *mainloop);
 SliceReturnType slice_mainloop_run(SliceMainloop *mainloop, char *err);
 void slice_mainloop_quit(SliceMainloop *mainloop);
-SliceBuffer *slice_mainloop_get_buffer_bucket(SliceMainloop *mainloop);
-int slice_mainloop_get_buffer_bucket_count(SliceMainloop *mainloop);
-SliceReturnType slice_mainloop_buffer_bucket_add(SliceMainloop *mainloop, SliceBuffer *buffer, char *err);
-SliceReturnType slice_mainloop_buffer_bucket_remove(SliceMainloop *mainloop, SliceBuffer *buffer, char *err);
+SliceReturnType slice_mainloop_post(SliceMainloop *mainloop, void(*callback)(SliceMainloop*, void*), void *arg, char *err);
+SliceReturnType slice_mainloop_set_stats(SliceMainloop *mainloop, int enable, char *err);
+SliceReturnType slice_mainloop_get_stats(SliceMainloop *mainloop, SliceMainloopStats *stats, char *err);
+SliceReturnType slice_mainloop_reset_stats(SliceMainloop *mainloop, char *err);
+unsigned long long slice_mainloop_histogram_percentile(SliceMainloopHistogram *histogram, double percentile);
+SliceBufferPool *slice_mainloop_get_buffer_pool(SliceMainloop *mainloop);
+SliceReturnType slice_mainloop_set_buffer_arena(SliceMainloop *mainloop, unsigned long long size, char *err);
+void slice_mainloop_account_write_queue(SliceMainloop *mainloop, long long delta);
+unsigned long long slice_mainloop_get_write_queued(SliceMainloop *mainloop);
+SliceBuffer *slice_mainloop_get_read_scratch(SliceMainloop *mainloop, char *err);
 
 SliceMainloopEpollElement *slice_mainloop_epoll_get_event_element(SliceMainloop *mainloop, int fd, char *err);
 SliceReturnType slice_mainloop_epoll_set_callback(SliceMainloop *mainloop, int fd, SliceMainloopEpollEventCallback flag, void *callback, char *err);
@@ -84,7 +152,17 @@ SliceReturnType slice_mainloop_epoll_event_add_read(SliceMainloop *mainloop, int
 SliceReturnType slice_mainloop_epoll_event_add_write(SliceMainloop *mainloop, int fd, char *err);
 SliceReturnType slice_mainloop_epoll_event_remove_read(SliceMainloop *mainloop, int fd, char *err);
 SliceReturnType slice_mainloop_epoll_event_remove_write(SliceMainloop *mainloop, int fd, char *err);
+SliceReturnType slice_mainloop_epoll_event_ready(SliceMainloop *mainloop, int fd, char *err);
+SliceReturnType slice_mainloop_epoll_event_flush_write(SliceMainloop *mainloop, int fd, char *err);
+SliceReturnType slice_mainloop_epoll_event_rearm(SliceMainloop *mainloop, int fd, char *err);
 SliceReturnType slice_mainloop_epoll_event_remove(SliceMainloop *mainloop, int fd, char *err);
+SliceReturnType slice_mainloop_epoll_event_watch(SliceMainloop *mainloop, int fd, int watch_fd, char *err);
+SliceReturnType slice_mainloop_epoll_event_unwatch(SliceMainloop *mainloop, int watch_fd, char *err);
+SliceReturnType slice_mainloop_epoll_event_set_completion(SliceMainloop *mainloop, int fd, int listen, char *err);
+int slice_mainloop_epoll_event_recv(SliceMainloop *mainloop, int fd, void *buffer, unsigned int length);
+ssize_t slice_mainloop_epoll_event_sendmsg(SliceMainloop *mainloop, int fd, const struct msghdr *msg, int flags);
+int slice_mainloop_epoll_event_send_busy(SliceMainloop *mainloop, int fd);
+int slice_mainloop_epoll_event_accept(SliceMainloop *mainloop, int fd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 
 SliceMainloopEvent *slice_mainloop_epoll_element_get_slice_mainloop_event(SliceMainloopEpollElement *mainloop_epoll_element);
 SliceReturnType slice_mainloop_epoll_element_set_slice_mainloop_event(SliceMainloopEpollElement *mainloop_epoll_element, SliceMainloopEvent *slice_event, char *err);
@@ -103,12 +181,25 @@ SliceReturnType slice_mainloop_event_set_callback(SliceMainloopEvent *mainloop_e
 #define SliceMainloopEventRemove(_mainloop, _event, _err) slice_mainloop_event_remove(_mainloop, (SliceMainloopEvent*)_event, _err)
 #define SliceMainloopSetUserData(_mainloop, _user_data, _err) slice_mainloop_set_user_data(_mainloop, _user_data, _err)
 #define SliceMainloopSetCallback(_mainloop, _ev_num, _callback, _err) slice_mainloop_set_callback(_mainloop, _ev_num, _callback, _err)
+#define SliceMainloopSetEngine(_mainloop, _engine, _err) slice_mainloop_set_engine(_mainloop, _engine, _err)
+#define SliceMainloopGetEngine(_mainloop) slice_mainloop_get_engine(_mainloop)
+#define SliceMainloopTimerStart(_mainloop, _timer, _timeout, _interval, _err) slice_mainloop_timer_start(_mainloop, _timer, _timeout, _interval, _err)
+#define SliceMainloopTimerStop(_mainloop, _timer, _err) slice_mainloop_timer_stop(_mainloop, _timer, _err)
+#define SliceMainloopGetTimerWheel(_mainloop) slice_mainloop_get_timer_wheel(_mainloop)
+#define SliceMainloopSetBusyPoll(_mainloop, _budget, _err) slice_mainloop_set_busy_poll(_mainloop, _budget, _err)
+#define SliceMainloopGetBusyPoll(_mainloop) slice_mainloop_get_busy_poll(_mainloop)
 #define SliceMainloopRun(_mainloop, _err) slice_mainloop_run(_mainloop, _err)
 #define SliceMainloopQuit(_mainloop) slice_mainloop_quit(_mainloop)
-#define SliceMainloopGetBufferBucket(_mainloop) slice_mainloop_get_buffer_bucket(_mainloop)
-#define SliceMainloopGetBufferBucketCount(_mainloop) slice_mainloop_get_buffer_bucket_count(_mainloop)
-#define SliceMainloopBufferBucketAdd(_mainloop, _buffer, _err) slice_mainloop_buffer_bucket_add(_mainloop, _buffer, _err)
-#define SliceMainloopBufferBucketRemove(_mainloop, _buffer, _err) slice_mainloop_buffer_bucket_remove(_mainloop, _buffer, _err)
+#define SliceMainloopPost(_mainloop, _callback, _arg, _err) slice_mainloop_post(_mainloop, _callback, (void*)_arg, _err)
+#define SliceMainloopSetStats(_mainloop, _enable, _err) slice_mainloop_set_stats(_mainloop, _enable, _err)
+#define SliceMainloopGetStats(_mainloop, _stats, _err) slice_mainloop_get_stats(_mainloop, _stats, _err)
+#define SliceMainloopResetStats(_mainloop, _err) slice_mainloop_reset_stats(_mainloop, _err)
+#define SliceMainloopHistogramPercentile(_histogram, _percentile) slice_mainloop_histogram_percentile(_histogram, _percentile)
+#define SliceMainloopGetBufferPool(_mainloop) slice_mainloop_get_buffer_pool(_mainloop)
+#define SliceMainloopSetBufferArena(_mainloop, _size, _err) slice_mainloop_set_buffer_arena(_mainloop, _size, _err)
+#define SliceMainloopAccountWriteQueue(_mainloop, _delta) slice_mainloop_account_write_queue(_mainloop, _delta)
+#define SliceMainloopGetWriteQueued(_mainloop) slice_mainloop_get_write_queued(_mainloop)
+#define SliceMainloopGetReadScratch(_mainloop, _err) slice_mainloop_get_read_scratch(_mainloop, _err)
 
 #define SliceMainloopEpollGetEventElement(_mainloop, _fd, _err) slice_mainloop_epoll_get_event_element(_mainloop, _fd, _err)
 #define SliceMainloopEpollEventSetCallback(_mainloop, _fd, _flag, _callback, _err) slice_mainloop_epoll_set_callback(_mainloop, _fd, _flag, _callback, _err)
@@ -117,7 +208,17 @@ SliceReturnType slice_mainloop_event_set_callback(SliceMainloopEvent *mainloop_e
 #define SliceMainloopEpollEventAddWrite(_mainloop, _fd, _err) slice_mainloop_epoll_event_add_write(_mainloop, _fd, _err)
 #define SliceMainloopEpollEventRemoveRead(_mainloop, _fd, _err) slice_mainloop_epoll_event_remove_read(_mainloop, _fd, _err)
 #define SliceMainloopEpollEventRemoveWrite(_mainloop, _fd, _err) slice_mainloop_epoll_event_remove_write(_mainloop, _fd, _err)
+#define SliceMainloopEpollEventReady(_mainloop, _fd, _err) slice_mainloop_epoll_event_ready(_mainloop, _fd, _err)
+#define SliceMainloopEpollEventFlushWrite(_mainloop, _fd, _err) slice_mainloop_epoll_event_flush_write(_mainloop, _fd, _err)
+#define SliceMainloopEpollEventRearm(_mainloop, _fd, _err) slice_mainloop_epoll_event_rearm(_mainloop, _fd, _err)
 #define SliceMainloopEpollEventRemove(_mainloop, _fd, _err) slice_mainloop_epoll_event_remove(_mainloop, _fd, _err)
+#define SliceMainloopEpollEventWatch(_mainloop, _fd, _watch_fd, _err) slice_mainloop_epoll_event_watch(_mainloop, _fd, _watch_fd, _err)
+#define SliceMainloopEpollEventUnwatch(_mainloop, _watch_fd, _err) slice_mainloop_epoll_event_unwatch(_mainloop, _watch_fd, _err)
+#define SliceMainloopEpollEventSetCompletion(_mainloop, _fd, _listen, _err) slice_mainloop_epoll_event_set_completion(_mainloop, _fd, _listen, _err)
+#define SliceMainloopEpollEventRecv(_mainloop, _fd, _buffer, _length) slice_mainloop_epoll_event_recv(_mainloop, _fd, _buffer, _length)
+#define SliceMainloopEpollEventSendmsg(_mainloop, _fd, _msg, _flags) slice_mainloop_epoll_event_sendmsg(_mainloop, _fd, _msg, _flags)
+#define SliceMainloopEpollEventSendBusy(_mainloop, _fd) slice_mainloop_epoll_event_send_busy(_mainloop, _fd)
+#define SliceMainloopEpollEventAccept(_mainloop, _fd, _addr, _addrlen, _flags) slice_mainloop_epoll_event_accept(_mainloop, _fd, _addr, _addrlen, _flags)
 
 #define SliceMainloopEpollElementGetSliceMainloopEvent(_mainloop_epoll_element) slice_mainloop_epoll_element_get_slice_mainloop_event(_mainloop_epoll_element)
 #define SliceMainloopEpollElementSetSliceMainloopEvent(_mainloop_epoll_element, _slice_event, _err) slice_mainloop_epoll_element_set_slice_mainloop_event(_mainloop_epoll_element, _slice_event, _err)
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "slice-multiloop.h"
+
+typedef struct slice_multiloop_thread SliceMultiloopThread;
+
+struct slice_multiloop_thread
+{
+    SliceMultiloop *multiloop;
+    SliceMainloop *mainloop;
+
+    int index;
+    pthread_t thread;
+    int started;
+
+    SliceReturnType result;
+    char err[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+};
+
+struct slice_multiloop
+{
+    int loop_count;
+    int cpu_affinity;
+    int running;
+
+    SliceMultiloopThread *threads;
+};
+
+SliceMultiloop *slice_multiloop_create(int loop_count, int epoll_max_fd, int epoll_max_fetch_event, int epoll_timeout, char *err)
+{
+    SliceMultiloop *multiloop;
+    long cpu_count;
+    int i;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (loop_count <= 0) {
+        // one loop per online core
+        if ((cpu_count = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) cpu_count = 1;
+        loop_count = (int)cpu_count;
+    }
+
+    if (loop_count > SLICE_MULTILOOP_MAX_LOOP) {
+        if (err) sprintf(err, "Loop count [%d] exceed, max [%d]", loop_count, SLICE_MULTILOOP_MAX_LOOP);
+        return NULL;
+    }
+
+    if (!(multiloop = (SliceMultiloop*)malloc(sizeof(SliceMultiloop)))) {
+        if (err) sprintf(err, "Can't allocate multiloop memory");
+        return NULL;
+    }
+
+    memset(multiloop, 0, sizeof(SliceMultiloop));
+
+    if (!(multiloop->threads = (SliceMultiloopThread*)malloc(sizeof(SliceMultiloopThread) * loop_count))) {
+        if (err) sprintf(err, "Can't allocate multiloop thread memory");
+        free(multiloop);
+        return NULL;
+    }
+
+    memset(multiloop->threads, 0, sizeof(SliceMultiloopThread) * loop_count);
+
+    for (i = 0; i < loop_count; i++) {
+        multiloop->threads[i].multiloop = multiloop;
+        multiloop->threads[i].index = i;
+
+        if (!(multiloop->threads[i].mainloop = SliceMainloopCreate(epoll_max_fd, epoll_max_fetch_event, epoll_timeout, err_buff))) {
+            if (err) sprintf(err, "Loop [%d] SliceMainloopCreate return error [%s]", i, err_buff);
+            multiloop->loop_count = i;
+            slice_multiloop_destroy(multiloop, NULL);
+            return NULL;
+        }
+    }
+
+    multiloop->loop_count = loop_count;
+
+    return multiloop;
+}
+
+SliceReturnType slice_multiloop_destroy(SliceMultiloop *multiloop, char *err)
+{
+    int i;
+
+    if (!multiloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (multiloop->running) {
+        if (err) sprintf(err, "Multiloop is still running");
+        return SLICE_RETURN_ERROR;
+    }
+
+    for (i = 0; i < multiloop->loop_count; i++) {
+        if (multiloop->threads[i].mainloop) {
+            SliceMainloopDestroy(multiloop->threads[i].mainloop, NULL);
+            multiloop->threads[i].mainloop = NULL;
+        }
+    }
+
+    free(multiloop->threads);
+    free(multiloop);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+int slice_multiloop_get_loop_count(SliceMultiloop *multiloop)
+{
+    if (!multiloop) return -1;
+
+    return multiloop->loop_count;
+}
+
+SliceMainloop *slice_multiloop_get_mainloop(SliceMultiloop *multiloop, int index)
+{
+    if (!multiloop || index < 0 || index >= multiloop->loop_count) return NULL;
+
+    return multiloop->threads[index].mainloop;
+}
+
+SliceReturnType slice_multiloop_set_cpu_affinity(SliceMultiloop *multiloop, int enable, char *err)
+{
+    if (!multiloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    multiloop->cpu_affinity = enable;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// a spinning loop burns its core, best combined with cpu affinity
+SliceReturnType slice_multiloop_set_busy_poll(SliceMultiloop *multiloop, unsigned int budget, char *err)
+{
+    int i;
+
+    if (!multiloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    for (i = 0; i < multiloop->loop_count; i++) {
+        if (SliceMainloopSetBusyPoll(multiloop->threads[i].mainloop, budget, err) != SLICE_RETURN_NORMAL) return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// size is per loop, each loop gets its own arena
+SliceReturnType slice_multiloop_set_buffer_arena(SliceMultiloop *multiloop, unsigned long long size, char *err)
+{
+    int i;
+
+    if (!multiloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    for (i = 0; i < multiloop->loop_count; i++) {
+        if (SliceMainloopSetBufferArena(multiloop->threads[i].mainloop, size, err) != SLICE_RETURN_NORMAL) return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// every loop gets its own SO_REUSEPORT listener, the kernel spreads connections between them
+SliceReturnType slice_multiloop_server_create(SliceMultiloop *multiloop, SliceServerMode mode, char *bind_ip, int bind_port, SliceSSLContext *ssl_ctx, SliceReturnType(*accept_cb)(SliceSession*, char*), SliceReturnType(*ready_cb)(SliceSession*, char*), SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), SliceServerOptions *options, char *err)
+{
+    SliceServerOptions server_options;
+    SliceServer **servers;
+    int i;
+
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!multiloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // kept to close the listeners already bound when a later loop fails
+    if (!(servers = (SliceServer**)calloc(multiloop->loop_count, sizeof(SliceServer*)))) {
+        if (err) sprintf(err, "Can't allocate server list");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (options) {
+        memcpy(&server_options, options, sizeof(SliceServerOptions));
+    } else {
+        SliceServerOptionsInit(&server_options);
+    }
+
+    server_options.reuse_port = 1;
+
+    for (i = 0; i < multiloop->loop_count; i++) {
+        if (!(servers[i] = SliceServerCreateWithOptions(multiloop->threads[i].mainloop, mode, bind_ip, bind_port, ssl_ctx, accept_cb, ready_cb, read_callback, close_callback, &server_options, err_buff))) {
+            if (err) sprintf(err, "Loop [%d] SliceServerCreateWithOptions return error [%s]", i, err_buff);
+
+            while (--i >= 0) SliceServerDestroy(servers[i], NULL);
+
+            free(servers);
+            return SLICE_RETURN_ERROR;
+        }
+    }
+
+    free(servers);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+static void *slice_multiloop_thread_run(void *arg)
+{
+    SliceMultiloopThread *thread = (SliceMultiloopThread*)arg;
+    SliceMultiloop *multiloop = thread->multiloop;
+    long cpu_count;
+    cpu_set_t cpu_set;
+
+    if (multiloop->cpu_affinity && (cpu_count = sysconf(_SC_NPROCESSORS_ONLN)) > 0) {
+        CPU_ZERO(&cpu_set);
+        CPU_SET(thread->index % cpu_count, &cpu_set);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+            printf("Loop [%d] can't set cpu affinity\n", thread->index);
+        }
+    }
+
+    thread->err[0] = 0;
+
+    if ((thread->result = SliceMainloopRun(thread->mainloop, thread->err)) != SLICE_RETURN_NORMAL) {
+        printf("Loop [%d] SliceMainloopRun return error [%s]\n", thread->index, thread->err);
+
+        // one loop failed, stop the others
+        slice_multiloop_quit(multiloop);
+    }
+
+    return NULL;
+}
+
+SliceReturnType slice_multiloop_run(SliceMultiloop *multiloop, char *err)
+{
+    SliceReturnType ret = SLICE_RETURN_NORMAL;
+    int i, r;
+
+    if (!multiloop) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (multiloop->running) {
+        if (err) sprintf(err, "Multiloop is already running");
+        return SLICE_RETURN_ERROR;
+    }
+
+    multiloop->running = 1;
+
+    // loop 0 runs on the calling thread
+    for (i = 1; i < multiloop->loop_count; i++) {
+        if ((r = pthread_create(&(multiloop->threads[i].thread), NULL, slice_multiloop_thread_run, &(multiloop->threads[i]))) != 0) {
+            if (err) sprintf(err, "Loop [%d] pthread_create return error [%s]", i, strerror(r));
+            ret = SLICE_RETURN_ERROR;
+            slice_multiloop_quit(multiloop);
+            break;
+        }
+
+        multiloop->threads[i].started = 1;
+    }
+
+    if (ret == SLICE_RETURN_NORMAL) {
+        slice_multiloop_thread_run(&(multiloop->threads[0]));
+    }
+
+    for (i = 1; i < multiloop->loop_count; i++) {
+        if (multiloop->threads[i].started) {
+            pthread_join(multiloop->threads[i].thread, NULL);
+            multiloop->threads[i].started = 0;
+        }
+    }
+
+    multiloop->running = 0;
+
+    if (ret != SLICE_RETURN_NORMAL) return ret;
+
+    for (i = 0; i < multiloop->loop_count; i++) {
+        if (multiloop->threads[i].result != SLICE_RETURN_NORMAL) {
+            if (err) sprintf(err, "Loop [%d] return error [%s]", i, multiloop->threads[i].err);
+            return multiloop->threads[i].result;
+        }
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+void slice_multiloop_quit(SliceMultiloop *multiloop)
+{
+    int i;
+
+    if (!multiloop) return;
+
+    for (i = 0; i < multiloop->loop_count; i++) {
+        SliceMainloopQuit(multiloop->threads[i].mainloop);
+    }
+}
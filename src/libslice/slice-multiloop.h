@@ -0,0 +1,41 @@
+#ifndef _SLICE_MULTILOOP_H_
+#define _SLICE_MULTILOOP_H_
+
+#include "slice-mainloop.h"
+#include "slice-server.h"
+
+#define SLICE_MULTILOOP_MAX_LOOP            256
+
+typedef struct slice_multiloop SliceMultiloop;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SliceMultiloop *slice_multiloop_create(int loop_count, int epoll_max_fd, int epoll_max_fetch_event, int epoll_timeout, char *err);
+SliceReturnType slice_multiloop_destroy(SliceMultiloop *multiloop, char *err);
+int slice_multiloop_get_loop_count(SliceMultiloop *multiloop);
+SliceMainloop *slice_multiloop_get_mainloop(SliceMultiloop *multiloop, int index);
+SliceReturnType slice_multiloop_set_cpu_affinity(SliceMultiloop *multiloop, int enable, char *err);
+SliceReturnType slice_multiloop_set_busy_poll(SliceMultiloop *multiloop, unsigned int budget, char *err);
+SliceReturnType slice_multiloop_set_buffer_arena(SliceMultiloop *multiloop, unsigned long long size, char *err);
+SliceReturnType slice_multiloop_server_create(SliceMultiloop *multiloop, SliceServerMode mode, char *bind_ip, int bind_port, SliceSSLContext *ssl_ctx, SliceReturnType(*accept_cb)(SliceSession*, char*), SliceReturnType(*ready_cb)(SliceSession*, char*), SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), SliceServerOptions *options, char *err);
+SliceReturnType slice_multiloop_run(SliceMultiloop *multiloop, char *err);
+void slice_multiloop_quit(SliceMultiloop *multiloop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SliceMultiloopCreate(_loop_count, _max_fd, _max_fetch_ev, _timeout, _err) slice_multiloop_create(_loop_count, _max_fd, _max_fetch_ev, _timeout, _err)
+#define SliceMultiloopDestroy(_multiloop, _err) slice_multiloop_destroy(_multiloop, _err)
+#define SliceMultiloopGetLoopCount(_multiloop) slice_multiloop_get_loop_count(_multiloop)
+#define SliceMultiloopGetMainloop(_multiloop, _index) slice_multiloop_get_mainloop(_multiloop, _index)
+#define SliceMultiloopSetCPUAffinity(_multiloop, _enable, _err) slice_multiloop_set_cpu_affinity(_multiloop, _enable, _err)
+#define SliceMultiloopSetBusyPoll(_multiloop, _budget, _err) slice_multiloop_set_busy_poll(_multiloop, _budget, _err)
+#define SliceMultiloopSetBufferArena(_multiloop, _size, _err) slice_multiloop_set_buffer_arena(_multiloop, _size, _err)
+#define SliceMultiloopServerCreate(_multiloop, _mode, _bind_ip, _bind_port, _ssl_ctx, _accept_cb, _ready_cb, _read_callabck, _close_callback, _options, _err) slice_multiloop_server_create(_multiloop, _mode, _bind_ip, _bind_port, _ssl_ctx, _accept_cb, _ready_cb, _read_callabck, _close_callback, _options, _err)
+#define SliceMultiloopRun(_multiloop, _err) slice_multiloop_run(_multiloop, _err)
+#define SliceMultiloopQuit(_multiloop) slice_multiloop_quit(_multiloop)
+
+#endif
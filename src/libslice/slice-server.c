@@ -1,6 +1,10 @@
 
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -25,104 +29,57 @@ struct slice_server
 
     SliceSession *sessions;
     int sessions_count;
+
+    SliceServerOptions options;
 };
 
-static SliceReturnType slice_server_read_callback(SliceMainloopEpoll *epoll, SliceMainloopEpollElement *element, struct epoll_event ev, void *user_data)
+// nonblocking only for sockets from accept4 with SOCK_NONBLOCK, the session then skips its fcntl
+static void slice_server_accept_session(SliceServer *server, int sock, struct sockaddr *addr_p, int nonblocking)
 {
-    SliceServer *server;
     SliceSession *session;
-    struct sockaddr *addr_p;
-    struct sockaddr_in addr;
-    struct sockaddr_in6 addr6;
-    int sock, skflag;
-    socklen_t socklen;
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    if (!epoll || !element) {
-        return SLICE_RETURN_ERROR;
+    if (!(session = (nonblocking) ? slice_session_create_accepted(server->mainloop_event.mainloop, server, sock, addr_p, server->mode, server->ssl_ctx, server->read_callback, server->close_callback, NULL, err_buff) : slice_session_create(server->mainloop_event.mainloop, server, sock, addr_p, server->mode, server->ssl_ctx, server->read_callback, server->close_callback, NULL, err_buff))) {
+        printf("SliceSessionCreate return error [%s]\n", err_buff);
+        close(sock);
+        return;
     }
 
-    server = (SliceServer*)SliceMainloopEpollElementGetSliceMainloopEvent(element);
+    SliceSessionListAppend(&(server->sessions), session, NULL);
+    server->sessions_count++;
 
-    if (!server) {
-        printf("Read callback but server not found\n");
-        return SLICE_RETURN_ERROR;
+    if (server->options.idle_timeout) SliceSessionSetTimeout(session, SLICE_CONNECTION_TIMEOUT_IDLE, server->options.idle_timeout, NULL);
+    if (server->options.handshake_timeout && server->ssl_ctx) SliceSessionSetTimeout(session, SLICE_CONNECTION_TIMEOUT_HANDSHAKE, server->options.handshake_timeout, NULL);
+    if (server->options.write_timeout) SliceSessionSetTimeout(session, SLICE_CONNECTION_TIMEOUT_WRITE, server->options.write_timeout, NULL);
+    if (server->options.read_buffer_timeout) SliceSessionSetTimeout(session, SLICE_CONNECTION_TIMEOUT_READ_BUFFER, server->options.read_buffer_timeout, NULL);
+    if (server->options.read_budget) SliceSessionSetReadBudget(session, server->options.read_budget, NULL);
+    if (server->options.read_segmented) SliceSessionSetReadSegmented(session, 1, NULL);
+    if (server->options.read_scratch) SliceSessionSetReadScratch(session, 1, NULL);
+
+    if (server->options.busy_poll && SliceSessionSetBusyPoll(session, server->options.busy_poll, err_buff) != SLICE_RETURN_NORMAL) {
+        // not fatal, the session just polls through the normal path
+        printf("Session sock [%d] SliceSessionSetBusyPoll return error [%s]\n", sock, err_buff);
     }
 
-    if (server->mode == SLICE_SERVER_MODE_IP4_TCP) {
-ip4_tcp_accept_again:
-        socklen = sizeof(addr);
-        if ((sock = accept(server->sock, (struct sockaddr*)(&addr), &socklen)) < 0) {
-            if (errno == EINTR) goto ip4_tcp_accept_again;
-            if (errno == EAGAIN || errno == EWOULDBLOCK) return SLICE_RETURN_NORMAL;
-#ifdef EPROTO
-            if (errno == EPROTO) return SLICE_RETURN_NORMAL;
-#endif
-#ifdef ECONNABORTED
-            if (errno == ECONNABORTED) return SLICE_RETURN_NORMAL;
-#endif
-            return SLICE_RETURN_NORMAL;
-            //return SLICE_RETURN_ERROR;
-        }
-
-        addr_p = (struct sockaddr*)&addr;
-    } else if (server->mode == SLICE_SERVER_MODE_IP6_TCP) {
-ip6_tcp_accept_again:
-        socklen = sizeof(addr6);
-        if ((sock = accept(server->sock, (struct sockaddr*)(&addr6), &socklen)) < 0) {
-            if (errno == EINTR) goto ip6_tcp_accept_again;
-            if (errno == EAGAIN || errno == EWOULDBLOCK) return SLICE_RETURN_NORMAL;
-#ifdef EPROTO
-            if (errno == EPROTO) return SLICE_RETURN_NORMAL;
-#endif
-#ifdef ECONNABORTED
-            if (errno == ECONNABORTED) return SLICE_RETURN_NORMAL;
-#endif
-            return SLICE_RETURN_NORMAL;
-            //return SLICE_RETURN_ERROR;
-        }
-
-        addr_p = (struct sockaddr*)&addr6;
-    } else if (server->mode == SLICE_SERVER_MODE_IP4_UDP) {
-        printf("UDP server is not implemented\n");
-        return SLICE_RETURN_ERROR;
-    } else {
-        printf("Invalid server mode [%d]\n", (int)server->mode);
-        return SLICE_RETURN_ERROR;
+    if (server->options.zerocopy && !server->ssl_ctx && SliceSessionSetZerocopy(session, server->options.zerocopy, err_buff) != SLICE_RETURN_NORMAL) {
+        // not fatal, writes are copied as before
+        printf("Session sock [%d] SliceSessionSetZerocopy return error [%s]\n", sock, err_buff);
     }
 
-    if (server->mode == SLICE_SERVER_MODE_IP4_TCP || server->mode == SLICE_SERVER_MODE_IP6_TCP) {
-        if ((skflag = fcntl(sock, F_GETFL, 0)) < 0) {
-            printf("fcntl(F_GETFL) return error [%s]", strerror(errno));
-            close(sock);
-            return SLICE_RETURN_NORMAL;
-            //return SLICE_RETURN_ERROR;
-        }
-
-        if (fcntl(sock, F_SETFL, skflag | O_NONBLOCK) < 0) {
-            printf("fcntl(F_SETFL) return error [%s]", strerror(errno));
-            close(sock);
-            return SLICE_RETURN_NORMAL;
-            //return SLICE_RETURN_ERROR;
+    // a peer that never reads its replies can't make the session queue without bound
+    if (server->options.write_high_watermark) {
+        if (SliceSessionSetWriteWatermark(session, server->options.write_high_watermark, server->options.write_low_watermark, err_buff) != SLICE_RETURN_NORMAL) {
+            printf("Session sock [%d] SliceSessionSetWriteWatermark return error [%s]\n", sock, err_buff);
+        } else {
+            SliceSessionSetWritePeer(session, SliceSessionGetConnection(session), NULL);
         }
     }
 
-    if (!(session = slice_session_create(server->mainloop_event.mainloop, server, sock, addr_p, server->mode, server->ssl_ctx, server->read_callback, server->close_callback, NULL, err_buff))) {
-        printf("SliceSessionCreate return error [%s]\n", err_buff);
-        close(sock);
-        return SLICE_RETURN_NORMAL;
-        //return SLICE_RETURN_ERROR;
-    }
-
-    SliceSessionListAppend(&(server->sessions), session, NULL);
-    server->sessions_count++;
-    
     if (server->accept_cb && server->accept_cb(session, err_buff) != SLICE_RETURN_NORMAL) {
         printf("Session sock [%d] accept callback return error [%s]\n", sock, err_buff);
         SliceSessionRemove(session, NULL);
         free(session);
-        return SLICE_RETURN_NORMAL;
-        //return SLICE_RETURN_ERROR;
+        return;
     }
 
     if (!server->ssl_ctx) {
@@ -130,11 +87,66 @@ ip6_tcp_accept_again:
             printf("Session sock [%d] ready callback return error [%s]\n", sock, err_buff);
             SliceSessionRemove(session, NULL);
             free(session);
+            return;
+        }
+    }
+}
+
+// drain the edge triggered listener up to the accept budget, the rest is picked up from the ready queue
+static SliceReturnType slice_server_read_callback(SliceMainloopEpoll *epoll, SliceMainloopEpollElement *element, struct epoll_event ev, void *user_data)
+{
+    SliceServer *server;
+    struct sockaddr_storage addr;
+    unsigned int budget, count;
+    int sock;
+    socklen_t socklen;
+
+    if (!epoll || !element) {
+        return SLICE_RETURN_ERROR;
+    }
+
+    server = (SliceServer*)SliceMainloopEpollElementGetSliceMainloopEvent(element);
+
+    if (!server) {
+        printf("Read callback but server not found\n");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (server->mode == SLICE_SERVER_MODE_IP4_UDP) {
+        printf("UDP server is not implemented\n");
+        return SLICE_RETURN_ERROR;
+    } else if (server->mode != SLICE_SERVER_MODE_IP4_TCP && server->mode != SLICE_SERVER_MODE_IP6_TCP) {
+        printf("Invalid server mode [%d]\n", (int)server->mode);
+        return SLICE_RETURN_ERROR;
+    }
+
+    budget = (server->options.accept_budget) ? server->options.accept_budget : SLICE_SERVER_DEFAULT_ACCEPT_BUDGET;
+
+    for (count = 0; count < budget; count++) {
+        socklen = sizeof(addr);
+
+        // sockets come non-blocking, the session needs no fcntl
+        if ((sock = SliceMainloopEpollEventAccept(server->mainloop_event.mainloop, server->sock, (struct sockaddr*)&addr, &socklen, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return SLICE_RETURN_NORMAL;
+#ifdef EPROTO
+            if (errno == EPROTO) continue;
+#endif
+#ifdef ECONNABORTED
+            if (errno == ECONNABORTED) continue;
+#endif
+            // EMFILE and the like, retrying now would only spin
+            printf("accept4 return error [%s]\n", strerror(errno));
             return SLICE_RETURN_NORMAL;
             //return SLICE_RETURN_ERROR;
         }
+
+        slice_server_accept_session(server, sock, (struct sockaddr*)&addr, 1);
     }
 
+    // budget spent, more connections may be waiting
+    SliceMainloopEpollEventReady(server->mainloop_event.mainloop, server->sock, NULL);
+
     return SLICE_RETURN_NORMAL;
 }
 
@@ -173,13 +185,91 @@ static SliceReturnType slice_server_remove_callback(SliceMainloopEvent *mainloop
 
 static SliceReturnType slice_server_add_callback(SliceMainloopEvent *mainloop_event, char *err)
 {
+    // on an io_uring loop connections come from accept requests, not readiness polls
+    if (SliceMainloopEpollEventSetCompletion(mainloop_event->mainloop, mainloop_event->io.fd, 1, err) == SLICE_RETURN_ERROR) return SLICE_RETURN_ERROR;
+
     SliceMainloopEpollEventSetCallback(mainloop_event->mainloop, mainloop_event->io.fd, SLICE_MAINLOOP_EPOLL_EVENT_READ, slice_server_read_callback, NULL);
     SliceMainloopEpollEventAddRead(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
 
     return SLICE_RETURN_NORMAL;
 }
 
+void slice_server_options_init(SliceServerOptions *options)
+{
+    if (!options) return;
+
+    memset(options, 0, sizeof(SliceServerOptions));
+}
+
+// options which must be set before bind
+static SliceReturnType slice_server_set_bind_options(int sock, SliceServerOptions *options, char *err)
+{
+    int value;
+
+    if (!options) return SLICE_RETURN_NORMAL;
+
+    if (options->reuse_port) {
+        value = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) != 0) {
+            if (err) sprintf(err, "setsockopt(SO_REUSEPORT) return error [%s]", strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// options set on the listener before listen
+static SliceReturnType slice_server_set_listen_options(int sock, SliceServerOptions *options, char *err)
+{
+    int value;
+
+    if (!options) return SLICE_RETURN_NORMAL;
+
+    if (options->rcvbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &(options->rcvbuf), sizeof(options->rcvbuf)) != 0) {
+        if (err) sprintf(err, "setsockopt(SO_RCVBUF) return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (options->sndbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &(options->sndbuf), sizeof(options->sndbuf)) != 0) {
+        if (err) sprintf(err, "setsockopt(SO_SNDBUF) return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (options->nodelay) {
+        value = 1;
+        if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) != 0) {
+            if (err) sprintf(err, "setsockopt(TCP_NODELAY) return error [%s]", strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+    }
+
+    if (options->defer_accept > 0 && setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &(options->defer_accept), sizeof(options->defer_accept)) != 0) {
+        if (err) sprintf(err, "setsockopt(TCP_DEFER_ACCEPT) return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+
+#ifdef TCP_FASTOPEN
+    if (options->fastopen > 0 && setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &(options->fastopen), sizeof(options->fastopen)) != 0) {
+        if (err) sprintf(err, "setsockopt(TCP_FASTOPEN) return error [%s]", strerror(errno));
+        return SLICE_RETURN_ERROR;
+    }
+#else
+    if (options->fastopen > 0) {
+        if (err) sprintf(err, "TCP_FASTOPEN is not supported");
+        return SLICE_RETURN_ERROR;
+    }
+#endif
+
+    return SLICE_RETURN_NORMAL;
+}
+
 SliceServer *slice_server_create(SliceMainloop *mainloop, SliceServerMode mode, char *bind_ip, int bind_port, SliceSSLContext *ssl_ctx, SliceReturnType(*accept_cb)(SliceSession*, char*), SliceReturnType(*ready_cb)(SliceSession*, char*), SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), char *err)
+{
+    return slice_server_create_with_options(mainloop, mode, bind_ip, bind_port, ssl_ctx, accept_cb, ready_cb, read_callback, close_callback, NULL, err);
+}
+
+SliceServer *slice_server_create_with_options(SliceMainloop *mainloop, SliceServerMode mode, char *bind_ip, int bind_port, SliceSSLContext *ssl_ctx, SliceReturnType(*accept_cb)(SliceSession*, char*), SliceReturnType(*ready_cb)(SliceSession*, char*), SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), SliceServerOptions *options, char *err)
 {
     SliceServer *server;
     socklen_t socklen;
@@ -218,6 +308,11 @@ SliceServer *slice_server_create(SliceMainloop *mainloop, SliceServerMode mode,
             return NULL;
         }
 
+        if (slice_server_set_bind_options(sock, options, err) != SLICE_RETURN_NORMAL) {
+            close(sock);
+            return NULL;
+        }
+
         socklen = sizeof(addr);
         if (bind(sock, (struct sockaddr*)&addr, socklen) != 0) {
             if (err) sprintf(err, "bind to port [%d] return error [%s]", bind_port, strerror(errno));
@@ -240,6 +335,11 @@ SliceServer *slice_server_create(SliceMainloop *mainloop, SliceServerMode mode,
             return NULL;
         }
 
+        if (slice_server_set_bind_options(sock, options, err) != SLICE_RETURN_NORMAL) {
+            close(sock);
+            return NULL;
+        }
+
         socklen = sizeof(addr6);
         if (bind(sock, (struct sockaddr*)&addr6, socklen) != 0) {
             if (err) sprintf(err, "bind to port [%d] return error [%s]", bind_port, strerror(errno));
@@ -275,7 +375,12 @@ SliceServer *slice_server_create(SliceMainloop *mainloop, SliceServerMode mode,
     }
 
     if (mode == SLICE_SERVER_MODE_IP4_TCP || mode == SLICE_SERVER_MODE_IP6_TCP) {
-        if (listen(sock, 256) != 0) {
+        if (slice_server_set_listen_options(sock, options, err) != SLICE_RETURN_NORMAL) {
+            close(sock);
+            return NULL;
+        }
+
+        if (listen(sock, (options && options->backlog > 0) ? options->backlog : SLICE_SERVER_DEFAULT_BACKLOG) != 0) {
             if (err) sprintf(err, "listen return error [%s]", strerror(errno));
             close(sock);
             return NULL;
@@ -300,6 +405,12 @@ SliceServer *slice_server_create(SliceMainloop *mainloop, SliceServerMode mode,
     server->close_callback = close_callback;
     server->ssl_ctx = ssl_ctx;
 
+    if (options) {
+        memcpy(&(server->options), options, sizeof(SliceServerOptions));
+    } else {
+        slice_server_options_init(&(server->options));
+    }
+
     SliceIOInit(server, sock, NULL);
     SliceMainloopEventSetUserData(server, NULL, NULL);
 
@@ -317,3 +428,23 @@ SliceServer *slice_server_create(SliceMainloop *mainloop, SliceServerMode mode,
 
     return server;
 }
+
+// stop listening, remove the sessions and free the server, from its own loop thread or before the loop runs
+SliceReturnType slice_server_destroy(SliceServer *server, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!server) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (SliceMainloopEventRemove(server->mainloop_event.mainloop, server, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceMainloopEventRemove return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    free(server);
+
+    return SLICE_RETURN_NORMAL;
+}
@@ -5,8 +5,12 @@
 #include "slice-session.h"
 #include "slice-ssl-server.h"
 
+#define SLICE_SERVER_DEFAULT_ACCEPT_BUDGET      64
+#define SLICE_SERVER_DEFAULT_BACKLOG            256
+
 typedef enum slice_server_mode SliceServerMode;
 typedef struct slice_server SliceServer;
+typedef struct slice_server_options SliceServerOptions;
 
 enum slice_server_mode
 {
@@ -15,11 +19,44 @@ enum slice_server_mode
     SLICE_SERVER_MODE_IP4_UDP = SLICE_CONNECTION_MODE_IP4_UDP
 };
 
+struct slice_server_options
+{
+    int reuse_port;                 // SO_REUSEPORT, lets several loops bind the same address
+
+    // listener socket, accepted sockets inherit the buffer sizes and TCP_NODELAY, 0 keeps the system default
+    int backlog;                    // 0 keeps SLICE_SERVER_DEFAULT_BACKLOG
+    int defer_accept;               // TCP_DEFER_ACCEPT in seconds, sessions are created once data arrives
+    int fastopen;                   // TCP_FASTOPEN queue length
+    int rcvbuf;                     // SO_RCVBUF
+    int sndbuf;                     // SO_SNDBUF
+    int nodelay;                    // TCP_NODELAY
+
+    // accepted sessions deadlines in ms, 0 disables
+    unsigned int idle_timeout;
+    unsigned int handshake_timeout;
+    unsigned int write_timeout;
+    unsigned int read_buffer_timeout;   // empty read buffers go back to the pool after this long without reads
+
+    unsigned int accept_budget;     // connections accepted per listener wake, 0 keeps SLICE_SERVER_DEFAULT_ACCEPT_BUDGET
+    unsigned int read_budget;       // bytes per read round of a session, 0 keeps SLICE_CONNECTION_DEFAULT_READ_BUDGET
+    unsigned int busy_poll;         // SO_BUSY_POLL in us on accepted sessions, 0 keeps the system default
+    unsigned int zerocopy;          // write batches of at least this many bytes use MSG_ZEROCOPY on plain TCP sessions, 0 disables
+    int read_segmented;             // sessions chain read blocks instead of growing one buffer, for multi-MB frames
+    int read_scratch;               // sessions read into the loop scratch, only leftovers of partial frames are kept per session
+
+    // session write queue in bytes, the session stops reading at high until its queue drains to low, 0 disables
+    unsigned long long write_high_watermark;
+    unsigned long long write_low_watermark;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 SliceServer *slice_server_create(SliceMainloop *mainloop, SliceServerMode mode, char *bind_ip, int bind_port, SliceSSLContext *ssl_ctx, SliceReturnType(*accept_cb)(SliceSession*, char*), SliceReturnType(*ready_cb)(SliceSession*, char*), SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), char *err);
+SliceServer *slice_server_create_with_options(SliceMainloop *mainloop, SliceServerMode mode, char *bind_ip, int bind_port, SliceSSLContext *ssl_ctx, SliceReturnType(*accept_cb)(SliceSession*, char*), SliceReturnType(*ready_cb)(SliceSession*, char*), SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), SliceServerOptions *options, char *err);
+SliceReturnType slice_server_destroy(SliceServer *server, char *err);
+void slice_server_options_init(SliceServerOptions *options);
 void slice_server_remove_session(SliceServer *server, SliceSession *session);   // for session remove only
 
 #ifdef __cplusplus
@@ -27,6 +64,9 @@ void slice_server_remove_session(SliceServer *server, SliceSession *session);
 #endif
 
 #define SliceServerCreate(_mainloop, _mode, _bind_ip, _bind_port, _ssl_ctx, _accept_cb, _ready_cb, _read_callabck, _close_callback, _err) slice_server_create(_mainloop, _mode, _bind_ip, _bind_port, _ssl_ctx, _accept_cb, _ready_cb, _read_callabck, _close_callback, _err)
+#define SliceServerCreateWithOptions(_mainloop, _mode, _bind_ip, _bind_port, _ssl_ctx, _accept_cb, _ready_cb, _read_callabck, _close_callback, _options, _err) slice_server_create_with_options(_mainloop, _mode, _bind_ip, _bind_port, _ssl_ctx, _accept_cb, _ready_cb, _read_callabck, _close_callback, _options, _err)
+#define SliceServerDestroy(_server, _err) slice_server_destroy(_server, _err)
+#define SliceServerOptionsInit(_options) slice_server_options_init(_options)
 #define SliceServerRemoveSession(_server, _session) slice_server_remove_session(_server, _session)
 
 #endif
@@ -34,6 +34,10 @@ SliceReturnType slice_session_remove(SliceSession *session, char *err)
     if (mainloop_event->destroyed) return SLICE_RETURN_NORMAL;
     mainloop_event->destroyed = 1;
 
+    // while the event is still attached, its buffers and watches belong to this loop
+    if (session->connection) SliceConnectionDetach(session->connection, NULL);
+
+    // out of the interest set before the fd is closed, its number may be reused by another loop right away
     if (SliceMainloopEventRemove(session->mainloop_event.mainloop, session, err_buff) != SLICE_RETURN_NORMAL) {
         if (err) sprintf(err, "SliceMainloopEventRemove return error [%s]", err_buff);
         return SLICE_RETURN_ERROR;
@@ -70,15 +74,18 @@ static SliceReturnType slice_session_read_callback(SliceMainloopEpoll *epoll, Sl
 
     if ((ret = slice_connection_socket_read(session->connection, &r, err_buff)) == SLICE_RETURN_ERROR) {
         printf("slice_connection_socket_read return error [%s]\n", err_buff);
-        slice_session_remove(session, NULL);
-        free(session);
-        return SLICE_RETURN_ERROR;
-    } else if (ret == SLICE_RETURN_INFO) {
-        return SLICE_RETURN_NORMAL;
+    } else if (ret == SLICE_RETURN_NORMAL && r > 0 && session->read_callback(session, r, session->mainloop_event.user_data, "read") != 0) {
+        printf("session read callback return error\n");
+        ret = SLICE_RETURN_ERROR;
     }
 
-    if (r > 0 && session->read_callback(session, r, session->mainloop_event.user_data, "read") != 0) {
-        printf("session read callback return error\n");
+    // the loop scratch is lent for this round only, it goes back here whatever the read and the callback returned
+    if (slice_connection_socket_read_done(session->connection, err_buff) != SLICE_RETURN_NORMAL) {
+        printf("slice_connection_socket_read_done return error [%s]\n", err_buff);
+        ret = SLICE_RETURN_ERROR;
+    }
+
+    if (ret == SLICE_RETURN_ERROR) {
         slice_session_remove(session, NULL);
         free(session);
         return SLICE_RETURN_ERROR;
@@ -111,12 +118,44 @@ static SliceReturnType slice_session_write_callback(SliceMainloopEpoll *epoll, S
     return SLICE_RETURN_NORMAL;
 }
 
+// EPOLLERR also reports zero-copy completions queued on the socket error queue
+static SliceReturnType slice_session_close_callback(SliceMainloopEpoll *epoll, SliceMainloopEpollElement *element, struct epoll_event ev, void *user_data)
+{
+    SliceSession *session;
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!epoll || !element) {
+        return SLICE_RETURN_ERROR;
+    }
+
+    session = (SliceSession*)SliceMainloopEpollElementGetSliceMainloopEvent(element);
+
+    if (!session) return SLICE_RETURN_ERROR;
+
+    if (SliceConnectionZerocopyComplete(session->connection, err_buff) < 0) {
+        printf("SliceConnectionZerocopyComplete return error [%s]\n", err_buff);
+        slice_session_remove(session, NULL);
+        free(session);
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
 static SliceReturnType slice_session_add_callback(SliceMainloopEvent *mainloop_event, char *err)
 {
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    // not fatal, the session reads and writes on readiness instead
+    if (SliceConnectionSetCompletion(((SliceSession*)mainloop_event)->connection, err_buff) == SLICE_RETURN_ERROR) {
+        printf("Session sock [%d] SliceConnectionSetCompletion return error [%s]\n", mainloop_event->io.fd, err_buff);
+    }
+
     SliceMainloopEpollEventSetCallback(mainloop_event->mainloop, mainloop_event->io.fd, SLICE_MAINLOOP_EPOLL_EVENT_READ, slice_session_read_callback, NULL);
     SliceMainloopEpollEventAddRead(mainloop_event->mainloop, mainloop_event->io.fd, NULL);
 
     SliceMainloopEpollEventSetCallback(mainloop_event->mainloop, mainloop_event->io.fd, SLICE_MAINLOOP_EPOLL_EVENT_WRITE, slice_session_write_callback, NULL);
+    SliceMainloopEpollEventSetCallback(mainloop_event->mainloop, mainloop_event->io.fd, SLICE_MAINLOOP_EPOLL_EVENT_CLOSE, slice_session_close_callback, NULL);
 
     return SLICE_RETURN_NORMAL;
 }
@@ -135,12 +174,12 @@ static SliceReturnType slice_session_remove_callback(SliceMainloopEvent *mainloo
     return SLICE_RETURN_NORMAL;
 }
 
-SliceSession *slice_session_create(SliceMainloop *mainloop, SliceServer *server, int sock, struct sockaddr *addr, SliceConnectionMode mode, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err)
+static SliceSession *slice_session_create_internal(SliceMainloop *mainloop, SliceServer *server, int sock, struct sockaddr *addr, int nonblocking, SliceConnectionMode mode, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err)
 {
     SliceSession *session;
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
 
-    if (!mainloop || sock < 0 || sock > 0xffff || !read_callback || !close_callback) {
+    if (!mainloop || sock < 0 || !read_callback || !close_callback) {
         if (err) sprintf(err, "Invalid parameter");
         return NULL;
     }
@@ -169,7 +208,8 @@ SliceSession *slice_session_create(SliceMainloop *mainloop, SliceServer *server,
         return NULL;
     }
 
-    if (!(session->connection = SliceConnectionCreate(session, sock, mode, SLICE_CONNECTION_TYPE_SESSION, err_buff))) {
+    // the address from accept saves a getpeername
+    if (!(session->connection = (addr) ? SliceConnectionCreateAccepted(session, sock, addr, nonblocking, mode, SLICE_CONNECTION_TYPE_SESSION, err_buff) : SliceConnectionCreate(session, sock, mode, SLICE_CONNECTION_TYPE_SESSION, err_buff))) {
         printf("SliceConnectionCreate return error [%s]\n", err_buff);
         if (err) sprintf(err, "SliceConnectionCreate return error [%s]", err_buff);
         free(session);
@@ -206,6 +246,22 @@ SliceSession *slice_session_create(SliceMainloop *mainloop, SliceServer *server,
     return session;
 }
 
+SliceSession *slice_session_create(SliceMainloop *mainloop, SliceServer *server, int sock, struct sockaddr *addr, SliceConnectionMode mode, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err)
+{
+    return slice_session_create_internal(mainloop, server, sock, addr, 0, mode, ssl_ctx, read_callback, close_callback, user_data, err);
+}
+
+// for the accept4 path of the server, the socket is known to be non-blocking already
+SliceSession *slice_session_create_accepted(SliceMainloop *mainloop, SliceServer *server, int sock, struct sockaddr *addr, SliceConnectionMode mode, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err)
+{
+    if (!addr) {
+        if (err) sprintf(err, "Invalid parameter");
+        return NULL;
+    }
+
+    return slice_session_create_internal(mainloop, server, sock, addr, 1, mode, ssl_ctx, read_callback, close_callback, user_data, err);
+}
+
 SliceReturnType slice_session_write(SliceSession *session, SliceBuffer *buffer, char *err)
 {
     char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
@@ -220,7 +276,64 @@ SliceReturnType slice_session_write(SliceSession *session, SliceBuffer *buffer,
         return SLICE_RETURN_ERROR;
     }
 
-    SliceMainloopEpollEventAddWrite(session->mainloop_event.mainloop, session->mainloop_event.io.fd, NULL);
+    SliceMainloopEpollEventFlushWrite(session->mainloop_event.mainloop, session->mainloop_event.io.fd, NULL);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_session_writev(SliceSession *session, const struct iovec *iov, int iovcnt, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!session || !iov) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (SliceConnectionWritev(session->connection, iov, iovcnt, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceConnectionWritev return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    SliceMainloopEpollEventFlushWrite(session->mainloop_event.mainloop, session->mainloop_event.io.fd, NULL);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_session_write_shared(SliceSession *session, SliceBuffer *buffer, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!session || !buffer) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (SliceConnectionWriteShared(session->connection, buffer, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceConnectionWriteShared return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    SliceMainloopEpollEventFlushWrite(session->mainloop_event.mainloop, session->mainloop_event.io.fd, NULL);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_session_write_file(SliceSession *session, int fd, unsigned long long offset, unsigned int length, char *err)
+{
+    char err_buff[SLICE_DEFAULT_ERROR_BUFF_SIZE];
+
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (SliceConnectionWriteFile(session->connection, fd, offset, length, err_buff) != SLICE_RETURN_NORMAL) {
+        if (err) sprintf(err, "SliceConnectionWriteFile return error [%s]", err_buff);
+        return SLICE_RETURN_ERROR;
+    }
+
+    SliceMainloopEpollEventFlushWrite(session->mainloop_event.mainloop, session->mainloop_event.io.fd, NULL);
 
     return SLICE_RETURN_NORMAL;
 }
@@ -235,6 +348,63 @@ int slice_session_fetch_read_buffer(SliceSession *session, char *out, unsigned i
     return SliceConnectionFetchReadBuffer(session->connection, out, out_size, err);
 }
 
+SliceReturnType slice_session_peek_read_buffer(SliceSession *session, char **data, unsigned int *length, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionPeekReadBuffer(session->connection, data, length, err);
+}
+
+SliceReturnType slice_session_consume_read_buffer(SliceSession *session, unsigned int length, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionConsumeReadBuffer(session->connection, length, err);
+}
+
+SliceReturnType slice_session_set_read_segmented(SliceSession *session, int enable, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetReadSegmented(session->connection, enable, err);
+}
+
+int slice_session_peek_read_iovec(SliceSession *session, struct iovec *iov, int iovcnt, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return -1;
+    }
+
+    return SliceConnectionPeekReadIovec(session->connection, iov, iovcnt, err);
+}
+
+SliceReturnType slice_session_set_read_scratch(SliceSession *session, int enable, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetReadScratch(session->connection, enable, err);
+}
+
+unsigned long long slice_session_get_read_length(SliceSession *session)
+{
+    if (!session) return 0;
+
+    return SliceConnectionGetReadLength(session->connection);
+}
+
 SliceBuffer *slice_session_get_read_buffer(SliceSession *session)
 {
     if (!session) return NULL;
@@ -259,6 +429,83 @@ SliceServer *slice_session_get_server(SliceSession *session)
     return session->server;
 }
 
+SliceReturnType slice_session_set_timeout(SliceSession *session, SliceConnectionTimeout type, unsigned int timeout, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetTimeout(session->connection, type, timeout, err);
+}
+
+SliceReturnType slice_session_set_read_budget(SliceSession *session, unsigned int budget, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetReadBudget(session->connection, budget, err);
+}
+
+SliceReturnType slice_session_set_busy_poll(SliceSession *session, unsigned int usec, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetBusyPoll(session->connection, usec, err);
+}
+
+SliceReturnType slice_session_set_zerocopy(SliceSession *session, unsigned int threshold, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetZerocopy(session->connection, threshold, err);
+}
+
+SliceReturnType slice_session_set_write_watermark(SliceSession *session, unsigned long long high, unsigned long long low, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetWriteWatermark(session->connection, high, low, err);
+}
+
+SliceReturnType slice_session_set_write_callback(SliceSession *session, void(*write_blocked_callback)(SliceConnection*, void*), void(*write_drained_callback)(SliceConnection*, void*), char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetWriteCallback(session->connection, write_blocked_callback, write_drained_callback, err);
+}
+
+SliceReturnType slice_session_set_write_peer(SliceSession *session, SliceConnection *peer, char *err)
+{
+    if (!session) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    return SliceConnectionSetWritePeer(session->connection, peer, err);
+}
+
+SliceConnection *slice_session_get_connection(SliceSession *session)
+{
+    if (!session) return NULL;
+
+    return session->connection;
+}
+
 char *slice_session_get_peer_ip(SliceSession *session)
 {
     return SliceConnectionGetPeerIP(session->connection);
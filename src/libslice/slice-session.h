@@ -13,12 +13,30 @@ extern "C" {
 #endif
 
 SliceSession *slice_session_create(SliceMainloop *mainloop, SliceServer *server, int sock, struct sockaddr *addr, SliceConnectionMode mode, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err);
+SliceSession *slice_session_create_accepted(SliceMainloop *mainloop, SliceServer *server, int sock, struct sockaddr *addr, SliceConnectionMode mode, SliceSSLContext *ssl_ctx, SliceReturnType(*read_callback)(SliceSession*, int, void*, char*), void(*close_callback)(SliceConnection*, void*, char*), void *user_data, char *err);   // for the server accept4 path only
 SliceReturnType slice_session_remove(SliceSession *session, char *err);
 SliceReturnType slice_session_write(SliceSession *session, SliceBuffer *buffer, char *err);
+SliceReturnType slice_session_writev(SliceSession *session, const struct iovec *iov, int iovcnt, char *err);
+SliceReturnType slice_session_write_shared(SliceSession *session, SliceBuffer *buffer, char *err);
+SliceReturnType slice_session_write_file(SliceSession *session, int fd, unsigned long long offset, unsigned int length, char *err);
 int slice_session_fetch_read_buffer(SliceSession *session, char *out, unsigned int out_size, char *err);
+SliceReturnType slice_session_peek_read_buffer(SliceSession *session, char **data, unsigned int *length, char *err);
+SliceReturnType slice_session_consume_read_buffer(SliceSession *session, unsigned int length, char *err);
+SliceReturnType slice_session_set_read_segmented(SliceSession *session, int enable, char *err);
+int slice_session_peek_read_iovec(SliceSession *session, struct iovec *iov, int iovcnt, char *err);
+unsigned long long slice_session_get_read_length(SliceSession *session);
+SliceReturnType slice_session_set_read_scratch(SliceSession *session, int enable, char *err);
 SliceBuffer *slice_session_get_read_buffer(SliceSession *session);
 SliceReturnType slice_session_clear_read_buffer(SliceSession *session, char *err);
 SliceServer *slice_session_get_server(SliceSession *session);
+SliceReturnType slice_session_set_timeout(SliceSession *session, SliceConnectionTimeout type, unsigned int timeout, char *err);
+SliceReturnType slice_session_set_read_budget(SliceSession *session, unsigned int budget, char *err);
+SliceReturnType slice_session_set_busy_poll(SliceSession *session, unsigned int usec, char *err);
+SliceReturnType slice_session_set_zerocopy(SliceSession *session, unsigned int threshold, char *err);
+SliceReturnType slice_session_set_write_watermark(SliceSession *session, unsigned long long high, unsigned long long low, char *err);
+SliceReturnType slice_session_set_write_callback(SliceSession *session, void(*write_blocked_callback)(SliceConnection*, void*), void(*write_drained_callback)(SliceConnection*, void*), char *err);
+SliceReturnType slice_session_set_write_peer(SliceSession *session, SliceConnection *peer, char *err);
+SliceConnection *slice_session_get_connection(SliceSession *session);
 char *slice_session_get_peer_ip(SliceSession *session);
 int slice_session_get_peer_port(SliceSession *session);
 SliceReturnType slice_session_list_append(SliceSession **head, SliceSession *item, char *err);
@@ -29,12 +47,30 @@ SliceReturnType slice_session_list_remove(SliceSession **head, SliceSession *ite
 #endif
 
 #define SliceSessionCreate(_mainloop, _server, _sock, _addr, _mode, _ssl_ctx, _read_callback, _close_callback, _user_data, _err) slice_session_create(_mainloop, _server, _sock, _addr, _mode, _ssl_ctx, _read_callback, _close_callback, _user_data, _err)
+#define SliceSessionCreateAccepted(_mainloop, _server, _sock, _addr, _mode, _ssl_ctx, _read_callback, _close_callback, _user_data, _err) slice_session_create_accepted(_mainloop, _server, _sock, _addr, _mode, _ssl_ctx, _read_callback, _close_callback, _user_data, _err)
 #define SliceSessionRemove(_session, _err) slice_session_remove(_session, _err)
 #define SliceSessionWrite(_session, _buffer, _err) slice_session_write(_session, _buffer, _err)
+#define SliceSessionWritev(_session, _iov, _iovcnt, _err) slice_session_writev(_session, _iov, _iovcnt, _err)
+#define SliceSessionWriteShared(_session, _buffer, _err) slice_session_write_shared(_session, _buffer, _err)
+#define SliceSessionWriteFile(_session, _fd, _offset, _length, _err) slice_session_write_file(_session, _fd, _offset, _length, _err)
 #define SliceSessionFetchReadBuffer(_session, _out, _out_size, _err) slice_session_fetch_read_buffer(_session, _out, _out_size, _err)
+#define SliceSessionPeekReadBuffer(_session, _data, _length, _err) slice_session_peek_read_buffer(_session, _data, _length, _err)
+#define SliceSessionConsumeReadBuffer(_session, _length, _err) slice_session_consume_read_buffer(_session, _length, _err)
+#define SliceSessionSetReadSegmented(_session, _enable, _err) slice_session_set_read_segmented(_session, _enable, _err)
+#define SliceSessionPeekReadIovec(_session, _iov, _iovcnt, _err) slice_session_peek_read_iovec(_session, _iov, _iovcnt, _err)
+#define SliceSessionGetReadLength(_session) slice_session_get_read_length(_session)
+#define SliceSessionSetReadScratch(_session, _enable, _err) slice_session_set_read_scratch(_session, _enable, _err)
 #define SliceSessionGetReadBuffer(_session) slice_session_get_read_buffer(_session)
 #define SliceSessionClearReadBuffer(_session, _err) slice_session_clear_read_buffer(_session, _err)
 #define SliceSessionGetServer(_session) slice_session_get_server(_session)
+#define SliceSessionSetTimeout(_session, _type, _timeout, _err) slice_session_set_timeout(_session, _type, _timeout, _err)
+#define SliceSessionSetReadBudget(_session, _budget, _err) slice_session_set_read_budget(_session, _budget, _err)
+#define SliceSessionSetBusyPoll(_session, _usec, _err) slice_session_set_busy_poll(_session, _usec, _err)
+#define SliceSessionSetZerocopy(_session, _threshold, _err) slice_session_set_zerocopy(_session, _threshold, _err)
+#define SliceSessionSetWriteWatermark(_session, _high, _low, _err) slice_session_set_write_watermark(_session, _high, _low, _err)
+#define SliceSessionSetWriteCallback(_session, _blocked_callback, _drained_callback, _err) slice_session_set_write_callback(_session, _blocked_callback, _drained_callback, _err)
+#define SliceSessionSetWritePeer(_session, _peer, _err) slice_session_set_write_peer(_session, _peer, _err)
+#define SliceSessionGetConnection(_session) slice_session_get_connection(_session)
 #define SliceSessionGetPeerIP(_session) slice_session_get_peer_ip(_session)
 #define SliceSessionGetPeerPort(_session) slice_session_get_peer_port(_session)
 #define SliceSessionListAppend(_head, _item, _err) slice_session_list_append(_head, _item, _err)
@@ -5,7 +5,11 @@
 
 #include "slice-ssl-client.h"
 
-#define MAX_SSL_CLIENT_CONTEXT_BUCKET           (64 * 1024)     // max fd number
+// contexts are paged by fd and shared by every loop thread, missing pages are installed atomically
+#define SLICE_SSL_CLIENT_CONTEXT_PAGE_BITS          12
+#define SLICE_SSL_CLIENT_CONTEXT_PAGE_SIZE          (1 << SLICE_SSL_CLIENT_CONTEXT_PAGE_BITS)
+#define SLICE_SSL_CLIENT_CONTEXT_PAGE_MASK          (SLICE_SSL_CLIENT_CONTEXT_PAGE_SIZE - 1)
+#define SLICE_SSL_CLIENT_CONTEXT_MAX_PAGE           4096        // 16M fds
 
 struct slice_ssl_clnt_context
 {
@@ -14,34 +18,56 @@ struct slice_ssl_clnt_context
     SSL *ssl;
 };
 
-struct slice_ssl_clnt_context *context_bucket;
+static struct slice_ssl_clnt_context **context_bucket;
+
+static struct slice_ssl_clnt_context *slice_SSL_client_get_context(int sockfd, int create)
+{
+    struct slice_ssl_clnt_context *page, *expected = NULL;
+    int index;
+
+    if (!context_bucket || sockfd < 0) return NULL;
+
+    if ((index = sockfd >> SLICE_SSL_CLIENT_CONTEXT_PAGE_BITS) >= SLICE_SSL_CLIENT_CONTEXT_MAX_PAGE) return NULL;
+
+    if (!(page = __atomic_load_n(&(context_bucket[index]), __ATOMIC_ACQUIRE))) {
+        if (!create) return NULL;
+
+        if (!(page = (struct slice_ssl_clnt_context*)calloc(SLICE_SSL_CLIENT_CONTEXT_PAGE_SIZE, sizeof(struct slice_ssl_clnt_context)))) return NULL;
+
+        // another loop thread may install the same page first
+        if (!__atomic_compare_exchange_n(&(context_bucket[index]), &expected, page, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(page);
+            page = expected;
+        }
+    }
+
+    return &(page[sockfd & SLICE_SSL_CLIENT_CONTEXT_PAGE_MASK]);
+}
 
 SliceReturnType slice_SSL_client_bucket_init(char *err)
 {
-    context_bucket = malloc(sizeof(*context_bucket) * MAX_SSL_CLIENT_CONTEXT_BUCKET);
+    context_bucket = calloc(SLICE_SSL_CLIENT_CONTEXT_MAX_PAGE, sizeof(*context_bucket));
     if (context_bucket == NULL) {
         if (err) sprintf(err, "Can't allocate memory for SSL Context bucket");
         return SLICE_RETURN_ERROR;
     }
 
-    memset(context_bucket, 0, sizeof(*context_bucket) * MAX_SSL_CLIENT_CONTEXT_BUCKET);
-
     return SLICE_RETURN_NORMAL;
 }
 
 SliceReturnType slice_SSL_client_connect(int sockfd, SliceSSLContext *context, char *err)
 {
-    if (sockfd >= MAX_SSL_CLIENT_CONTEXT_BUCKET) {
-        if (err) sprintf(err, "Sock [%d] : Socket number is over bucket size [%d]", sockfd, MAX_SSL_CLIENT_CONTEXT_BUCKET - 1);
-        return SLICE_RETURN_ERROR;
-    }
-
-    struct slice_ssl_clnt_context *client_context = &(context_bucket[sockfd]);
+    struct slice_ssl_clnt_context *client_context;
     int errnum, skflag;
     X509* server_cert;
     char *x509_str;
     int reterr;
 
+    if (!(client_context = slice_SSL_client_get_context(sockfd, 1))) {
+        if (err) sprintf(err, "Sock [%d] : Socket number is over bucket size or can't allocate context", sockfd);
+        return SLICE_RETURN_ERROR;
+    }
+
     switch (client_context->state) {
         case SLICE_SSL_STATE_IDLE:
             if ((skflag = fcntl(sockfd, F_GETFL, 0)) < 0) {
@@ -121,10 +147,12 @@ SliceReturnType slice_SSL_client_connect(int sockfd, SliceSSLContext *context, c
 
 SliceReturnType slice_SSL_client_shutdown(int sockfd, char *err)
 {
-    struct slice_ssl_clnt_context *client_context = &(context_bucket[sockfd]);
+    struct slice_ssl_clnt_context *client_context;
     int ret = SLICE_RETURN_NORMAL;
     int reterr;
 
+    if (!(client_context = slice_SSL_client_get_context(sockfd, 0))) return SLICE_RETURN_NORMAL;
+
     if (client_context->ssl != NULL) {
         if ((ret = SSL_shutdown(client_context->ssl)) < 0) {
             if (err) {
@@ -141,15 +169,24 @@ SliceReturnType slice_SSL_client_shutdown(int sockfd, char *err)
 
 SliceSSLState slice_SSL_client_get_state(int sockfd)
 {
-    return context_bucket[sockfd].state;
+    struct slice_ssl_clnt_context *client_context;
+
+    if (!(client_context = slice_SSL_client_get_context(sockfd, 0))) return SLICE_SSL_STATE_IDLE;
+
+    return client_context->state;
 }
 
 SliceReturnType slice_SSL_client_read(int sockfd, void *read_buff, size_t buff_len, int *read_len, int *err_num, char *err)
 {
-    struct slice_ssl_clnt_context *client_context = &(context_bucket[sockfd]);
+    struct slice_ssl_clnt_context *client_context;
     int ret;
     int reterr;
 
+    if (!(client_context = slice_SSL_client_get_context(sockfd, 0))) {
+        if (err) sprintf(err, "Sock [%d] : SSL context not found", sockfd);
+        return SLICE_RETURN_ERROR;
+    }
+
     *err_num = 0;
     *read_len = 0;
 
@@ -183,10 +220,15 @@ SliceReturnType slice_SSL_client_read(int sockfd, void *read_buff, size_t buff_l
 
 SliceReturnType slice_SSL_client_write(int sockfd, void *write_buff, size_t write_size, int *write_len, int *err_num, char *err)
 {
-    struct slice_ssl_clnt_context *client_context = &(context_bucket[sockfd]);
+    struct slice_ssl_clnt_context *client_context;
     int ret;
     int reterr;
 
+    if (!(client_context = slice_SSL_client_get_context(sockfd, 0))) {
+        if (err) sprintf(err, "Sock [%d] : SSL context not found", sockfd);
+        return SLICE_RETURN_ERROR;
+    }
+
     *err_num = 0;
     *write_len = 0;
 
@@ -216,18 +258,24 @@ SliceReturnType slice_SSL_client_write(int sockfd, void *write_buff, size_t writ
 SliceReturnType slice_SSL_client_bucket_destroy(char *err)
 {
     struct slice_ssl_clnt_context *client_context;
-    int i;
+    int i, j;
 
     if (!context_bucket) {
         if (err) sprintf(err, "Client context bucket not found");
         return SLICE_RETURN_INFO;
     }
 
-    for (i = 0; i < MAX_SSL_CLIENT_CONTEXT_BUCKET; i++) {
-        client_context = &(context_bucket[i]);
-        if (client_context->sock > 0 && client_context->ssl) {
-            slice_SSL_client_shutdown(client_context->sock, NULL);
+    for (i = 0; i < SLICE_SSL_CLIENT_CONTEXT_MAX_PAGE; i++) {
+        if (!context_bucket[i]) continue;
+
+        for (j = 0; j < SLICE_SSL_CLIENT_CONTEXT_PAGE_SIZE; j++) {
+            client_context = &(context_bucket[i][j]);
+            if (client_context->sock > 0 && client_context->ssl) {
+                slice_SSL_client_shutdown(client_context->sock, NULL);
+            }
         }
+
+        free(context_bucket[i]);
     }
 
     free(context_bucket);
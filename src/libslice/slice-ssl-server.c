@@ -4,7 +4,11 @@
 
 #include "slice-ssl-server.h"
 
-#define MAX_SSL_SESSION_CONTEXT_BUCKET              (64 * 1024)        // max fd number
+// contexts are paged by fd and shared by every loop thread, missing pages are installed atomically
+#define SLICE_SSL_SESSION_CONTEXT_PAGE_BITS          12
+#define SLICE_SSL_SESSION_CONTEXT_PAGE_SIZE          (1 << SLICE_SSL_SESSION_CONTEXT_PAGE_BITS)
+#define SLICE_SSL_SESSION_CONTEXT_PAGE_MASK          (SLICE_SSL_SESSION_CONTEXT_PAGE_SIZE - 1)
+#define SLICE_SSL_SESSION_CONTEXT_MAX_PAGE           4096        // 16M fds
 
 struct slice_ssl_sess_context
 {
@@ -13,37 +17,60 @@ struct slice_ssl_sess_context
     SSL *ssl;
 };
 
-struct slice_ssl_sess_context *context_bucket;
+static struct slice_ssl_sess_context **context_bucket;
+
+static struct slice_ssl_sess_context *slice_SSL_session_get_context(int sockfd, int create)
+{
+    struct slice_ssl_sess_context *page, *expected = NULL;
+    int index;
+
+    if (!context_bucket || sockfd < 0) return NULL;
+
+    if ((index = sockfd >> SLICE_SSL_SESSION_CONTEXT_PAGE_BITS) >= SLICE_SSL_SESSION_CONTEXT_MAX_PAGE) return NULL;
+
+    if (!(page = __atomic_load_n(&(context_bucket[index]), __ATOMIC_ACQUIRE))) {
+        if (!create) return NULL;
+
+        if (!(page = (struct slice_ssl_sess_context*)calloc(SLICE_SSL_SESSION_CONTEXT_PAGE_SIZE, sizeof(struct slice_ssl_sess_context)))) return NULL;
+
+        // another loop thread may install the same page first
+        if (!__atomic_compare_exchange_n(&(context_bucket[index]), &expected, page, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(page);
+            page = expected;
+        }
+    }
+
+    return &(page[sockfd & SLICE_SSL_SESSION_CONTEXT_PAGE_MASK]);
+}
 
 SliceReturnType slice_SSL_session_bucket_init(char *err)
 {
-    context_bucket = malloc(sizeof(struct slice_ssl_sess_context) * MAX_SSL_SESSION_CONTEXT_BUCKET);
+    context_bucket = calloc(SLICE_SSL_SESSION_CONTEXT_MAX_PAGE, sizeof(*context_bucket));
     if (context_bucket == NULL) {
         if (err) sprintf(err, "Can't allocate memory for SSL Context bucket");
         return SLICE_RETURN_ERROR;
     }
 
-    memset(context_bucket, 0, sizeof(struct slice_ssl_sess_context) * MAX_SSL_SESSION_CONTEXT_BUCKET);
-
     return SLICE_RETURN_NORMAL;
 }
 
 SliceReturnType slice_SSL_session_accept(int sockfd, SliceSSLContext *context, char *err)
 {
-    if (sockfd >= MAX_SSL_SESSION_CONTEXT_BUCKET) {
-        if (err) sprintf(err, "Session [%d] : Socket number is over bucket size [%d]", sockfd, MAX_SSL_SESSION_CONTEXT_BUCKET - 1);
-        return SLICE_RETURN_ERROR;
-    }
     if (!context) {
         if (err) sprintf(err, "Session [%d] : SSL Context is NULL", sockfd);
         return SLICE_RETURN_ERROR;
     }
 
-    struct slice_ssl_sess_context *session_context = &(context_bucket[sockfd]);
+    struct slice_ssl_sess_context *session_context;
     int reterr, errnum, skflag;
     //X509* client_cert;
     //char *x509_str;
 
+    if (!(session_context = slice_SSL_session_get_context(sockfd, 1))) {
+        if (err) sprintf(err, "Session [%d] : Socket number is over bucket size or can't allocate context", sockfd);
+        return SLICE_RETURN_ERROR;
+    }
+
     switch (session_context->state) {
         case SLICE_SSL_STATE_IDLE:
             if ((skflag = fcntl(sockfd, F_GETFL, 0)) < 0) {
@@ -128,10 +155,12 @@ SliceReturnType slice_SSL_session_accept(int sockfd, SliceSSLContext *context, c
 
 SliceReturnType slice_SSL_session_close(int sockfd, char *err)
 {
-    struct slice_ssl_sess_context *session_context = &(context_bucket[sockfd]);
+    struct slice_ssl_sess_context *session_context;
     int ret = SLICE_RETURN_NORMAL;
     int reterr;
 
+    if (!(session_context = slice_SSL_session_get_context(sockfd, 0))) return SLICE_RETURN_NORMAL;
+
     if (session_context->ssl) {
         if ((ret = SSL_shutdown(session_context->ssl)) < 0) {
             if (err) {
@@ -148,15 +177,24 @@ SliceReturnType slice_SSL_session_close(int sockfd, char *err)
 
 SliceSSLState slice_SSL_session_get_state(int sockfd)
 {
-    return context_bucket[sockfd].state;
+    struct slice_ssl_sess_context *session_context;
+
+    if (!(session_context = slice_SSL_session_get_context(sockfd, 0))) return SLICE_SSL_STATE_IDLE;
+
+    return session_context->state;
 }
 
 SliceReturnType slice_SSL_session_read(int sockfd, void *read_buff, size_t buff_len, int *read_len, int *err_num, char *err)
 {
-    struct slice_ssl_sess_context *session_context = &(context_bucket[sockfd]);
+    struct slice_ssl_sess_context *session_context;
     int ret;
     int reterr;
 
+    if (!(session_context = slice_SSL_session_get_context(sockfd, 0))) {
+        if (err) sprintf(err, "Session [%d] : SSL context not found", sockfd);
+        return SLICE_RETURN_ERROR;
+    }
+
     *err_num = 0;
     *read_len = 0;
 
@@ -190,10 +228,15 @@ SliceReturnType slice_SSL_session_read(int sockfd, void *read_buff, size_t buff_
 
 SliceReturnType slice_SSL_session_write(int sockfd, void *write_buff, size_t write_size, int *write_len, int *err_num, char *err)
 {
-    struct slice_ssl_sess_context *session_context = &(context_bucket[sockfd]);
+    struct slice_ssl_sess_context *session_context;
     int ret;
     int reterr;
 
+    if (!(session_context = slice_SSL_session_get_context(sockfd, 0))) {
+        if (err) sprintf(err, "Session [%d] : SSL context not found", sockfd);
+        return SLICE_RETURN_ERROR;
+    }
+
     *err_num = 0;
     *write_len = 0;
 
@@ -223,18 +266,24 @@ SliceReturnType slice_SSL_session_write(int sockfd, void *write_buff, size_t wri
 SliceReturnType slice_SSL_session_bucket_destroy(char *err)
 {
     struct slice_ssl_sess_context *sess_context;
-    int i;
+    int i, j;
 
     if (!context_bucket) {
         if (err) sprintf(err, "Session context bucket not found");
         return SLICE_RETURN_INFO;
     }
 
-    for (i = 0; i < MAX_SSL_SESSION_CONTEXT_BUCKET; i++) {
-        sess_context = &(context_bucket[i]);
-        if (sess_context->sock > 0 && sess_context->ssl) {
-            slice_SSL_session_close(sess_context->sock, NULL);
+    for (i = 0; i < SLICE_SSL_SESSION_CONTEXT_MAX_PAGE; i++) {
+        if (!context_bucket[i]) continue;
+
+        for (j = 0; j < SLICE_SSL_SESSION_CONTEXT_PAGE_SIZE; j++) {
+            sess_context = &(context_bucket[i][j]);
+            if (sess_context->sock > 0 && sess_context->ssl) {
+                slice_SSL_session_close(sess_context->sock, NULL);
+            }
         }
+
+        free(context_bucket[i]);
     }
 
     free(context_bucket);
@@ -0,0 +1,308 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "slice-timer.h"
+
+struct slice_timer_wheel
+{
+    unsigned long long current;     // last processed tick
+
+    int count;
+    int level_count[SLICE_TIMER_WHEEL_LEVEL];
+
+    SliceTimer *slots[SLICE_TIMER_WHEEL_LEVEL][SLICE_TIMER_WHEEL_SIZE];
+};
+
+unsigned long long slice_timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((unsigned long long)ts.tv_sec * 1000ULL) + ((unsigned long long)ts.tv_nsec / 1000000ULL);
+}
+
+SliceTimer *slice_timer_create(void(*callback)(SliceTimer*, void*), void *user_data, char *err)
+{
+    SliceTimer *timer;
+
+    if (!callback) {
+        if (err) sprintf(err, "Invalid parameter");
+        return NULL;
+    }
+
+    if (!(timer = (SliceTimer*)malloc(sizeof(SliceTimer)))) {
+        if (err) sprintf(err, "Can't allocate timer memory");
+        return NULL;
+    }
+
+    slice_timer_init(timer, callback, user_data, NULL);
+
+    return timer;
+}
+
+SliceReturnType slice_timer_init(SliceTimer *timer, void(*callback)(SliceTimer*, void*), void *user_data, char *err)
+{
+    if (!timer || !callback) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    memset(timer, 0, sizeof(SliceTimer));
+
+    timer->callback = callback;
+    timer->user_data = user_data;
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// only for timers from slice_timer_create, embedded timers are just stopped
+SliceReturnType slice_timer_destroy(SliceTimer *timer, char *err)
+{
+    if (!timer) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (timer->wheel) slice_timer_wheel_stop(timer->wheel, timer, NULL);
+
+    free(timer);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+int slice_timer_is_pending(SliceTimer *timer)
+{
+    if (!timer) return 0;
+
+    return (timer->wheel) ? 1 : 0;
+}
+
+static void slice_timer_wheel_link(SliceTimerWheel *wheel, SliceTimer *timer)
+{
+    unsigned long long expire, delta;
+    int level;
+
+    expire = (timer->expire > wheel->current) ? timer->expire : wheel->current + 1;
+    delta = expire - wheel->current;
+
+    if (delta >= (1ULL << (SLICE_TIMER_WHEEL_BITS * SLICE_TIMER_WHEEL_LEVEL))) {
+        // out of range, parked in the farthest slot and cascaded again from there
+        delta = (1ULL << (SLICE_TIMER_WHEEL_BITS * SLICE_TIMER_WHEEL_LEVEL)) - 1;
+        expire = wheel->current + delta;
+    }
+
+    for (level = 0; level < SLICE_TIMER_WHEEL_LEVEL - 1; level++) {
+        if (delta < (1ULL << (SLICE_TIMER_WHEEL_BITS * (level + 1)))) break;
+    }
+
+    timer->level = level;
+    timer->slot = (int)((expire >> (SLICE_TIMER_WHEEL_BITS * level)) & SLICE_TIMER_WHEEL_MASK);
+    timer->wheel = wheel;
+
+    SliceListAppend(&(wheel->slots[level][timer->slot]), timer, NULL);
+    wheel->level_count[level]++;
+    wheel->count++;
+}
+
+static void slice_timer_wheel_unlink(SliceTimerWheel *wheel, SliceTimer *timer)
+{
+    SliceListRemove(&(wheel->slots[timer->level][timer->slot]), timer, NULL);
+    wheel->level_count[timer->level]--;
+    wheel->count--;
+
+    timer->wheel = NULL;
+}
+
+SliceTimerWheel *slice_timer_wheel_create(char *err)
+{
+    SliceTimerWheel *wheel;
+
+    if (!(wheel = (SliceTimerWheel*)malloc(sizeof(SliceTimerWheel)))) {
+        if (err) sprintf(err, "Can't allocate timer wheel memory");
+        return NULL;
+    }
+
+    memset(wheel, 0, sizeof(SliceTimerWheel));
+
+    wheel->current = slice_timer_now();
+
+    return wheel;
+}
+
+SliceReturnType slice_timer_wheel_destroy(SliceTimerWheel *wheel, char *err)
+{
+    SliceTimer *timer;
+    int level, slot;
+
+    if (!wheel) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // pending timers belong to their owners, only unlink them
+    for (level = 0; level < SLICE_TIMER_WHEEL_LEVEL; level++) {
+        for (slot = 0; slot < SLICE_TIMER_WHEEL_SIZE; slot++) {
+            while ((timer = wheel->slots[level][slot])) {
+                slice_timer_wheel_unlink(wheel, timer);
+            }
+        }
+    }
+
+    free(wheel);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_timer_wheel_start(SliceTimerWheel *wheel, SliceTimer *timer, unsigned int timeout, unsigned int interval, char *err)
+{
+    if (!wheel || !timer) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    // re-arm of a pending timer
+    if (timer->wheel) slice_timer_wheel_unlink(timer->wheel, timer);
+
+    timer->expire = slice_timer_now() + timeout;
+    timer->interval = interval;
+
+    slice_timer_wheel_link(wheel, timer);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_timer_wheel_stop(SliceTimerWheel *wheel, SliceTimer *timer, char *err)
+{
+    if (!wheel || !timer) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!timer->wheel) return SLICE_RETURN_NORMAL;
+
+    if (timer->wheel != wheel) {
+        if (err) sprintf(err, "Timer is pending on another wheel");
+        return SLICE_RETURN_ERROR;
+    }
+
+    slice_timer_wheel_unlink(wheel, timer);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// ms until the nearest deadline, -1 when no timer is pending
+int slice_timer_wheel_next_timeout(SliceTimerWheel *wheel, unsigned long long now)
+{
+    unsigned long long next = 0, tick, base;
+    int level, i;
+
+    if (!wheel || wheel->count == 0) return -1;
+
+    // level 0 holds exact deadlines
+    if (wheel->level_count[0] > 0) {
+        for (i = 1; i <= SLICE_TIMER_WHEEL_SIZE; i++) {
+            tick = wheel->current + i;
+            if (wheel->slots[0][tick & SLICE_TIMER_WHEEL_MASK]) {
+                next = tick;
+                break;
+            }
+        }
+    }
+
+    // higher levels only tell the next cascade, which is early enough to wake for
+    for (level = 1; level < SLICE_TIMER_WHEEL_LEVEL; level++) {
+        if (wheel->level_count[level] == 0) continue;
+
+        base = wheel->current >> (SLICE_TIMER_WHEEL_BITS * level);
+
+        for (i = 1; i <= SLICE_TIMER_WHEEL_SIZE; i++) {
+            if (wheel->slots[level][(base + i) & SLICE_TIMER_WHEEL_MASK]) {
+                tick = (base + i) << (SLICE_TIMER_WHEEL_BITS * level);
+                if (!next || tick < next) next = tick;
+                break;
+            }
+        }
+    }
+
+    if (!next || next <= now) return 0;
+
+    return (next - now > INT_MAX) ? INT_MAX : (int)(next - now);
+}
+
+// run every timer due up to now, returns the number of fired timers
+int slice_timer_wheel_advance(SliceTimerWheel *wheel, unsigned long long now)
+{
+    SliceTimer *timer;
+    unsigned long long next;
+    int fired = 0, level, index;
+
+    if (!wheel) return -1;
+
+    while (wheel->current < now) {
+        if (wheel->count == 0) {
+            wheel->current = now;
+            break;
+        }
+
+        if (wheel->level_count[0] == 0) {
+            // nothing due on level 0, skip to the tick before the next cascade
+            next = wheel->current | SLICE_TIMER_WHEEL_MASK;
+
+            if (next >= now) {
+                wheel->current = now;
+                break;
+            }
+
+            wheel->current = next;
+        }
+
+        wheel->current++;
+
+        for (level = 1; level < SLICE_TIMER_WHEEL_LEVEL; level++) {
+            if (wheel->current & ((1ULL << (SLICE_TIMER_WHEEL_BITS * level)) - 1)) break;
+
+            index = (int)((wheel->current >> (SLICE_TIMER_WHEEL_BITS * level)) & SLICE_TIMER_WHEEL_MASK);
+
+            while ((timer = wheel->slots[level][index])) {
+                slice_timer_wheel_unlink(wheel, timer);
+                slice_timer_wheel_link(wheel, timer);
+            }
+        }
+
+        index = (int)(wheel->current & SLICE_TIMER_WHEEL_MASK);
+
+        while ((timer = wheel->slots[0][index])) {
+            slice_timer_wheel_unlink(wheel, timer);
+
+            if (timer->expire > wheel->current) {
+                // parked out of range timer, not due yet
+                slice_timer_wheel_link(wheel, timer);
+                continue;
+            }
+
+            // periodic timers are re-linked first so the callback may stop or re-arm them
+            if (timer->interval) {
+                timer->expire += timer->interval;
+                if (timer->expire <= wheel->current) timer->expire = wheel->current + timer->interval;
+                slice_timer_wheel_link(wheel, timer);
+            }
+
+            fired++;
+
+            timer->callback(timer, timer->user_data);
+        }
+    }
+
+    return fired;
+}
+
+int slice_timer_wheel_get_count(SliceTimerWheel *wheel)
+{
+    if (!wheel) return -1;
+
+    return wheel->count;
+}
@@ -0,0 +1,66 @@
+#ifndef _SLICE_TIMER_H_
+#define _SLICE_TIMER_H_
+
+#include "slice-object.h"
+
+// 4 levels of 64 slots with a 1 ms tick cover about 4.6 hours, longer timers are cascaded again
+#define SLICE_TIMER_WHEEL_LEVEL             4
+#define SLICE_TIMER_WHEEL_BITS              6
+#define SLICE_TIMER_WHEEL_SIZE              (1 << SLICE_TIMER_WHEEL_BITS)
+#define SLICE_TIMER_WHEEL_MASK              (SLICE_TIMER_WHEEL_SIZE - 1)
+
+typedef struct slice_timer SliceTimer;
+typedef struct slice_timer_wheel SliceTimerWheel;
+
+struct slice_timer
+{
+    SliceObject obj;
+
+    SliceTimerWheel *wheel;         // set while the timer is pending
+    int level;
+    int slot;
+
+    unsigned long long expire;      // absolute tick
+    unsigned int interval;          // ms, 0 for one-shot
+
+    void(*callback)(SliceTimer*, void*);
+    void *user_data;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+unsigned long long slice_timer_now(void);
+SliceTimer *slice_timer_create(void(*callback)(SliceTimer*, void*), void *user_data, char *err);
+SliceReturnType slice_timer_init(SliceTimer *timer, void(*callback)(SliceTimer*, void*), void *user_data, char *err);
+SliceReturnType slice_timer_destroy(SliceTimer *timer, char *err);
+int slice_timer_is_pending(SliceTimer *timer);
+
+SliceTimerWheel *slice_timer_wheel_create(char *err);
+SliceReturnType slice_timer_wheel_destroy(SliceTimerWheel *wheel, char *err);
+SliceReturnType slice_timer_wheel_start(SliceTimerWheel *wheel, SliceTimer *timer, unsigned int timeout, unsigned int interval, char *err);
+SliceReturnType slice_timer_wheel_stop(SliceTimerWheel *wheel, SliceTimer *timer, char *err);
+int slice_timer_wheel_next_timeout(SliceTimerWheel *wheel, unsigned long long now);
+int slice_timer_wheel_advance(SliceTimerWheel *wheel, unsigned long long now);
+int slice_timer_wheel_get_count(SliceTimerWheel *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SliceTimerNow() slice_timer_now()
+#define SliceTimerCreate(_callback, _user_data, _err) slice_timer_create(_callback, (void*)_user_data, _err)
+#define SliceTimerInit(_timer, _callback, _user_data, _err) slice_timer_init(_timer, _callback, (void*)_user_data, _err)
+#define SliceTimerDestroy(_timer, _err) slice_timer_destroy(_timer, _err)
+#define SliceTimerIsPending(_timer) slice_timer_is_pending(_timer)
+
+#define SliceTimerWheelCreate(_err) slice_timer_wheel_create(_err)
+#define SliceTimerWheelDestroy(_wheel, _err) slice_timer_wheel_destroy(_wheel, _err)
+#define SliceTimerWheelStart(_wheel, _timer, _timeout, _interval, _err) slice_timer_wheel_start(_wheel, _timer, _timeout, _interval, _err)
+#define SliceTimerWheelStop(_wheel, _timer, _err) slice_timer_wheel_stop(_wheel, _timer, _err)
+#define SliceTimerWheelNextTimeout(_wheel, _now) slice_timer_wheel_next_timeout(_wheel, _now)
+#define SliceTimerWheelAdvance(_wheel, _now) slice_timer_wheel_advance(_wheel, _now)
+#define SliceTimerWheelGetCount(_wheel) slice_timer_wheel_get_count(_wheel)
+
+#endif
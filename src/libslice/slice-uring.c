@@ -0,0 +1,486 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "slice-uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+
+// completion of poll-remove and timeout requests, never reported to the caller
+#define SLICE_URING_USER_DATA_IGNORE        0xffffffffffffffffULL
+
+struct slice_uring
+{
+    int ring_fd;
+    unsigned int features;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_ring_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_pending;
+
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_ring_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int slice_uring_sys_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int slice_uring_sys_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg, size_t arg_size)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+SliceUring *slice_uring_create(unsigned int entries, char *err)
+{
+    SliceUring *ring;
+    struct io_uring_params params;
+
+    if (entries == 0) entries = SLICE_URING_DEFAULT_ENTRIES;
+
+    if (!(ring = (SliceUring*)malloc(sizeof(SliceUring)))) {
+        if (err) sprintf(err, "Can't allocate uring memory");
+        return NULL;
+    }
+
+    memset(ring, 0, sizeof(SliceUring));
+    memset(&params, 0, sizeof(params));
+
+    if ((ring->ring_fd = slice_uring_sys_setup(entries, &params)) < 0) {
+        if (err) sprintf(err, "io_uring_setup return error [%s]", strerror(errno));
+        free(ring);
+        return NULL;
+    }
+
+    ring->features = params.features;
+    ring->sq_entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    if ((ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+        if (err) sprintf(err, "mmap submission ring return error [%s]", strerror(errno));
+        close(ring->ring_fd);
+        free(ring);
+        return NULL;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else if ((ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        if (err) sprintf(err, "mmap completion ring return error [%s]", strerror(errno));
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->ring_fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if ((ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES)) == MAP_FAILED) {
+        if (err) sprintf(err, "mmap submission entries return error [%s]", strerror(errno));
+        if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->ring_fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_head = (unsigned int*)((char*)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned int*)((char*)ring->sq_ring + params.sq_off.tail);
+    ring->sq_ring_mask = (unsigned int*)((char*)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)((char*)ring->sq_ring + params.sq_off.array);
+
+    ring->cq_head = (unsigned int*)((char*)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)((char*)ring->cq_ring + params.cq_off.tail);
+    ring->cq_ring_mask = (unsigned int*)((char*)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+
+    return ring;
+}
+
+SliceReturnType slice_uring_destroy(SliceUring *ring, char *err)
+{
+    if (!ring) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->ring_fd);
+
+    free(ring);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_uring_submit(SliceUring *ring, char *err)
+{
+    int r;
+
+    if (!ring) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    while (ring->sq_pending > 0) {
+        if ((r = slice_uring_sys_enter(ring->ring_fd, ring->sq_pending, 0, 0, NULL, 0)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EBUSY) return SLICE_RETURN_INFO;
+            if (err) sprintf(err, "io_uring_enter return error [%s]", strerror(errno));
+            return SLICE_RETURN_ERROR;
+        }
+
+        if (r == 0) break;
+
+        ring->sq_pending -= (unsigned int)r;
+    }
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// entries are queued in shared memory, the kernel sees them on the next io_uring_enter
+static struct io_uring_sqe *slice_uring_get_sqe(SliceUring *ring, char *err)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int head, tail, index;
+
+    tail = *(ring->sq_tail);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= ring->sq_entries) {
+        if (slice_uring_submit(ring, err) == SLICE_RETURN_ERROR) return NULL;
+
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+        if (tail - head >= ring->sq_entries) {
+            if (err) sprintf(err, "Submission queue is full");
+            return NULL;
+        }
+    }
+
+    index = tail & *(ring->sq_ring_mask);
+    sqe = &(ring->sqes[index]);
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+
+    return sqe;
+}
+
+static void slice_uring_commit_sqe(SliceUring *ring)
+{
+    __atomic_store_n(ring->sq_tail, *(ring->sq_tail) + 1, __ATOMIC_RELEASE);
+    ring->sq_pending++;
+}
+
+SliceReturnType slice_uring_poll_add(SliceUring *ring, int fd, unsigned int poll_mask, unsigned long long user_data, char *err)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!ring || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(sqe = slice_uring_get_sqe(ring, err))) return SLICE_RETURN_ERROR;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = poll_mask;
+    sqe->user_data = user_data;
+
+    slice_uring_commit_sqe(ring);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_uring_poll_remove(SliceUring *ring, unsigned long long user_data, char *err)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!ring) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(sqe = slice_uring_get_sqe(ring, err))) return SLICE_RETURN_ERROR;
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = SLICE_URING_USER_DATA_IGNORE;
+
+    slice_uring_commit_sqe(ring);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_uring_recv(SliceUring *ring, int fd, void *buffer, unsigned int length, unsigned long long user_data, char *err)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!ring || fd < 0 || !buffer || length == 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(sqe = slice_uring_get_sqe(ring, err))) return SLICE_RETURN_ERROR;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(unsigned long)buffer;
+    sqe->len = length;
+    sqe->user_data = user_data | SLICE_URING_USER_DATA_IO;
+
+    slice_uring_commit_sqe(ring);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+SliceReturnType slice_uring_send(SliceUring *ring, int fd, const void *buffer, unsigned int length, unsigned long long user_data, char *err)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!ring || fd < 0 || !buffer || length == 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(sqe = slice_uring_get_sqe(ring, err))) return SLICE_RETURN_ERROR;
+
+    // a peer gone away completes with EPIPE instead of raising SIGPIPE
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(unsigned long)buffer;
+    sqe->len = length;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data | SLICE_URING_USER_DATA_IO;
+
+    slice_uring_commit_sqe(ring);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// addr and addrlen are written by the kernel when the request completes, they must stay valid until then
+SliceReturnType slice_uring_accept(SliceUring *ring, int fd, struct sockaddr *addr, socklen_t *addrlen, int flags, unsigned long long user_data, char *err)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!ring || fd < 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(sqe = slice_uring_get_sqe(ring, err))) return SLICE_RETURN_ERROR;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(unsigned long)addr;
+    sqe->addr2 = (unsigned long long)(unsigned long)addrlen;
+    sqe->accept_flags = (unsigned int)flags;
+    sqe->user_data = user_data | SLICE_URING_USER_DATA_IO;
+
+    slice_uring_commit_sqe(ring);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// the cancelled request still completes, with ECANCELED unless it finished first
+SliceReturnType slice_uring_cancel(SliceUring *ring, unsigned long long user_data, char *err)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!ring) {
+        if (err) sprintf(err, "Invalid parameter");
+        return SLICE_RETURN_ERROR;
+    }
+
+    if (!(sqe = slice_uring_get_sqe(ring, err))) return SLICE_RETURN_ERROR;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data | SLICE_URING_USER_DATA_IO;
+    sqe->user_data = SLICE_URING_USER_DATA_IGNORE;
+
+    slice_uring_commit_sqe(ring);
+
+    return SLICE_RETURN_NORMAL;
+}
+
+// submit everything queued and wait for completions in one system call,
+// completed polls are reported as epoll events carrying the poll user data, I/O requests with their result
+int slice_uring_wait(SliceUring *ring, struct epoll_event *events, int max_events, int timeout, char *err)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int head, tail, flags;
+    int r, count = 0;
+
+    if (!ring || !events || max_events <= 0) {
+        if (err) sprintf(err, "Invalid parameter");
+        return -1;
+    }
+
+    head = *(ring->cq_head);
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail && timeout != 0) {
+        flags = IORING_ENTER_GETEVENTS;
+
+        if (timeout > 0) {
+            memset(&ts, 0, sizeof(ts));
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+
+            if (ring->features & IORING_FEAT_EXT_ARG) {
+                memset(&arg, 0, sizeof(arg));
+                arg.ts = (unsigned long long)(unsigned long)&ts;
+                flags |= IORING_ENTER_EXT_ARG;
+                r = slice_uring_sys_enter(ring->ring_fd, ring->sq_pending, 1, flags, &arg, sizeof(arg));
+            } else {
+                if (!(sqe = slice_uring_get_sqe(ring, err))) return -1;
+
+                // completes after one other completion or when the time is up
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->fd = -1;
+                sqe->addr = (unsigned long long)(unsigned long)&ts;
+                sqe->len = 1;
+                sqe->off = 1;
+                sqe->user_data = SLICE_URING_USER_DATA_IGNORE;
+
+                slice_uring_commit_sqe(ring);
+
+                r = slice_uring_sys_enter(ring->ring_fd, ring->sq_pending, 1, flags, NULL, 0);
+            }
+        } else {
+            r = slice_uring_sys_enter(ring->ring_fd, ring->sq_pending, 1, flags, NULL, 0);
+        }
+
+        if (r < 0) {
+            if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+                if (err) sprintf(err, "io_uring_enter return error [%s]", strerror(errno));
+                return -1;
+            }
+        } else {
+            ring->sq_pending -= ((unsigned int)r > ring->sq_pending) ? ring->sq_pending : (unsigned int)r;
+        }
+    } else if (ring->sq_pending > 0) {
+        if (slice_uring_submit(ring, err) == SLICE_RETURN_ERROR) return -1;
+    }
+
+    head = *(ring->cq_head);
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && count < max_events) {
+        cqe = &(ring->cqes[head & *(ring->cq_ring_mask)]);
+
+        // cancelled or superseded polls complete with a negative result, for I/O it is the errno
+        if (cqe->user_data != SLICE_URING_USER_DATA_IGNORE && (cqe->res >= 0 || (cqe->user_data & SLICE_URING_USER_DATA_IO))) {
+            events[count].events = (uint32_t)cqe->res;
+            events[count].data.u64 = cqe->user_data;
+            count++;
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+#else
+
+SliceUring *slice_uring_create(unsigned int entries, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return NULL;
+}
+
+SliceReturnType slice_uring_destroy(SliceUring *ring, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+SliceReturnType slice_uring_poll_add(SliceUring *ring, int fd, unsigned int poll_mask, unsigned long long user_data, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+SliceReturnType slice_uring_poll_remove(SliceUring *ring, unsigned long long user_data, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+SliceReturnType slice_uring_recv(SliceUring *ring, int fd, void *buffer, unsigned int length, unsigned long long user_data, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+SliceReturnType slice_uring_send(SliceUring *ring, int fd, const void *buffer, unsigned int length, unsigned long long user_data, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+SliceReturnType slice_uring_accept(SliceUring *ring, int fd, struct sockaddr *addr, socklen_t *addrlen, int flags, unsigned long long user_data, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+SliceReturnType slice_uring_cancel(SliceUring *ring, unsigned long long user_data, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+SliceReturnType slice_uring_submit(SliceUring *ring, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return SLICE_RETURN_ERROR;
+}
+
+int slice_uring_wait(SliceUring *ring, struct epoll_event *events, int max_events, int timeout, char *err)
+{
+    if (err) sprintf(err, "io_uring is not supported on this build");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _SLICE_URING_H_
+#define _SLICE_URING_H_
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "slice.h"
+
+#define SLICE_URING_DEFAULT_ENTRIES         1024
+
+// requests tagged with this bit are I/O, their completion is reported whatever the result and events carries it as an int
+#define SLICE_URING_USER_DATA_IO            (1ULL << 63)
+
+typedef struct slice_uring SliceUring;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SliceUring *slice_uring_create(unsigned int entries, char *err);
+SliceReturnType slice_uring_destroy(SliceUring *ring, char *err);
+SliceReturnType slice_uring_poll_add(SliceUring *ring, int fd, unsigned int poll_mask, unsigned long long user_data, char *err);
+SliceReturnType slice_uring_poll_remove(SliceUring *ring, unsigned long long user_data, char *err);
+SliceReturnType slice_uring_recv(SliceUring *ring, int fd, void *buffer, unsigned int length, unsigned long long user_data, char *err);
+SliceReturnType slice_uring_send(SliceUring *ring, int fd, const void *buffer, unsigned int length, unsigned long long user_data, char *err);
+SliceReturnType slice_uring_accept(SliceUring *ring, int fd, struct sockaddr *addr, socklen_t *addrlen, int flags, unsigned long long user_data, char *err);
+SliceReturnType slice_uring_cancel(SliceUring *ring, unsigned long long user_data, char *err);
+SliceReturnType slice_uring_submit(SliceUring *ring, char *err);
+int slice_uring_wait(SliceUring *ring, struct epoll_event *events, int max_events, int timeout, char *err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SliceUringCreate(_entries, _err) slice_uring_create(_entries, _err)
+#define SliceUringDestroy(_ring, _err) slice_uring_destroy(_ring, _err)
+#define SliceUringPollAdd(_ring, _fd, _poll_mask, _user_data, _err) slice_uring_poll_add(_ring, _fd, _poll_mask, _user_data, _err)
+#define SliceUringPollRemove(_ring, _user_data, _err) slice_uring_poll_remove(_ring, _user_data, _err)
+#define SliceUringRecv(_ring, _fd, _buffer, _length, _user_data, _err) slice_uring_recv(_ring, _fd, _buffer, _length, _user_data, _err)
+#define SliceUringSend(_ring, _fd, _buffer, _length, _user_data, _err) slice_uring_send(_ring, _fd, _buffer, _length, _user_data, _err)
+#define SliceUringAccept(_ring, _fd, _addr, _addrlen, _flags, _user_data, _err) slice_uring_accept(_ring, _fd, _addr, _addrlen, _flags, _user_data, _err)
+#define SliceUringCancel(_ring, _user_data, _err) slice_uring_cancel(_ring, _user_data, _err)
+#define SliceUringSubmit(_ring, _err) slice_uring_submit(_ring, _err)
+#define SliceUringWait(_ring, _events, _max_events, _timeout, _err) slice_uring_wait(_ring, _events, _max_events, _timeout, _err)
+
+#endif